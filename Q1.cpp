@@ -1,98 +1,1783 @@
 #include <bits/stdc++.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "bench.h"
+#include "epoch.h"
+#include "metrics.h"
 using namespace std;
+
+// Default weigher: every entry weighs 1, so capacity is an entry count.
+// Supply a callable weight(key, value) instead to budget by bytes.
+struct unitweight
+{
+    template <typename K, typename V>
+    size_t operator()(const K &, const V &) const
+    {
+        return 1;
+    }
+};
+
+// fmix64 from MurmurHash3. std::hash is the identity for integers, so hash
+// values are mixed before their low bits pick a shard or sketch counter.
+inline uint64_t mix64(uint64_t h)
+{
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ULL;
+    h ^= h >> 33;
+    return h;
+}
+
+// Milliseconds on the steady clock: the tick of LRUCache's timing wheel.
+inline uint64_t steadyms()
+{
+    return chrono::duration_cast<chrono::milliseconds>(chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// Counters and latency histograms returned by LRUCache::stats(). Everything
+// stays zero, with enabled == false, unless built with -DENABLE_METRICS.
+struct CacheStats
+{
+    bool enabled = metricsenabled;
+    uint64_t hits = 0;
+    uint64_t misses = 0;
+    uint64_t inserts = 0;
+    uint64_t updates = 0;
+    uint64_t evictions = 0;
+    uint64_t expirations = 0;
+    LatencyHistogram getlatency;
+    LatencyHistogram putlatency;
+
+    double hitratio() const
+    {
+        return hits + misses ? (double)hits / (hits + misses) : 0.0;
+    }
+
+    void merge(const CacheStats &other)
+    {
+        hits += other.hits;
+        misses += other.misses;
+        inserts += other.inserts;
+        updates += other.updates;
+        evictions += other.evictions;
+        expirations += other.expirations;
+        getlatency.merge(other.getlatency);
+        putlatency.merge(other.putlatency);
+    }
+};
+
+// Header of an LRUCache snapshot file. count records follow, most recently
+// used first, each packed as key bytes, value bytes and the remaining TTL in
+// milliseconds (0 for none).
+struct snapshotheader
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t keysize;
+    uint32_t valsize;
+    uint32_t reserved;
+    uint64_t count;
+};
+
+// LRU cache over any hashable, copyable key and any movable value, including
+// move-only ones. Values are constructed in place and lookups hand out
+// pointers/references into the cache, so a hit never copies the value. They
+// stay valid until the entry is evicted or expires, or (weighted caches only)
+// until an insertion grows the slab.
+template <typename K, typename V, typename Hash = hash<K>, typename Weigher = unitweight>
 class LRUCache
 {
 public:
+    // Nodes live in a slab; prev/next are 32-bit slab indices. Slots 0 and 1
+    // are the head and tail sentinels. Evicted slots are chained through next
+    // and reused before the slab grows; when capacity counts entries the slab
+    // is allocated once, up front. Entries with a TTL are also linked into a
+    // timing-wheel slot through wnext/wprev, with wpos naming the slot.
     class node
     {
     public:
-        int key;
-        int val;
-        node *next;
-        node *prev;
-        node(int _key, int _val)
+        optional<pair<K, V>> kv;
+        size_t weight = 0;
+        uint64_t deadline = 0;
+        uint32_t next = nil;
+        uint32_t prev = nil;
+        uint32_t wnext = nil;
+        uint32_t wprev = nil;
+        uint16_t wpos = 0;
+    };
+
+    static constexpr uint32_t head = 0;
+    static constexpr uint32_t tail = 1;
+    static constexpr uint32_t nil = UINT32_MAX;
+
+    using maptype = pmr::unordered_map<K, uint32_t, Hash>;
+
+    size_t cap;
+    size_t total = 0;
+    vector<node> slab;
+    uint32_t freelist = nil;
+    // Map nodes come from a pool that recycles erased nodes, so steady-state
+    // puts and snapshot loads do not call malloc once per key.
+    pmr::unsynchronized_pool_resource pool;
+    maptype m;
+    Weigher weigher;
+    // get_or_insert's result when cap is 0
+    optional<V> uncached;
+
+    // Hierarchical timing wheel: 4 levels of 64 slots, 1 ms per slot at level
+    // 0 and 64x coarser at each level above. An entry waits in the slot for
+    // its deadline at the coarsest level it is that far out; reaching a
+    // coarse slot cascades its entries into finer levels, and reaching a
+    // level-0 slot expires them. The occupied bitmaps let advance() jump
+    // straight to the next non-empty slot however long the cache sat idle.
+    static constexpr int wheelbits = 6;
+    static constexpr int wheellevels = 4;
+
+    uint32_t wheel[wheellevels][64];
+    uint64_t occupied[wheellevels] = {};
+    uint64_t wheeltime = 0;
+    size_t timed = 0;
+    uint64_t (*clock)() = steadyms;
+
+    METRICS(CacheStats counters;)
+
+    explicit LRUCache(size_t capacity, Weigher weigher_ = Weigher(), Hash hash_ = Hash())
+        : cap(capacity), m(0, hash_, &pool), weigher(weigher_)
+    {
+        if (is_same<Weigher, unitweight>::value)
+        {
+            slab.reserve(cap + 2);
+            m.reserve(cap + 1);
+        }
+        slab.resize(2);
+        slab[head].next = tail;
+        slab[tail].prev = head;
+        for (auto &level : wheel)
+            fill(begin(level), end(level), nil);
+    }
+
+    size_t size() const
+    {
+        return m.size();
+    }
+
+    CacheStats stats() const
+    {
+#ifdef ENABLE_METRICS
+        return counters;
+#else
+        return CacheStats();
+#endif
+    }
+
+    // Summed weight of the cached entries; equals size() for unitweight.
+    size_t weight() const
+    {
+        return total;
+    }
+
+    void addnode(uint32_t newnode)
+    {
+        uint32_t temp = slab[head].next;
+        slab[newnode].next = temp;
+        slab[newnode].prev = head;
+        slab[head].next = newnode;
+        slab[temp].prev = newnode;
+    }
+
+    void deletenode(uint32_t delnode)
+    {
+        uint32_t delprev = slab[delnode].prev;
+        uint32_t delnext = slab[delnode].next;
+        slab[delprev].next = delnext;
+        slab[delnext].prev = delprev;
+    }
+
+    void movetofront(uint32_t slot)
+    {
+        if (slab[head].next != slot)
+        {
+            deletenode(slot);
+            addnode(slot);
+        }
+    }
+
+    void addnodeback(uint32_t newnode)
+    {
+        uint32_t temp = slab[tail].prev;
+        slab[newnode].prev = temp;
+        slab[newnode].next = tail;
+        slab[tail].prev = newnode;
+        slab[temp].next = newnode;
+    }
+
+    void wheelinsert(uint32_t slot)
+    {
+        uint64_t d = slab[slot].deadline;
+        uint64_t delta = d > wheeltime ? d - wheeltime : 0;
+        int level = delta < 64 ? 0 : (63 - __builtin_clzll(delta)) / wheelbits;
+        if (level >= wheellevels)
         {
-            key = _key;
-            val = _val;
+            // Too far out: park in the last top-level slot and re-cascade
+            level = wheellevels - 1;
+            d = wheeltime + (1ULL << (wheelbits * wheellevels)) - 1;
         }
+        int idx = (d >> (wheelbits * level)) & 63;
+
+        uint32_t first = wheel[level][idx];
+        slab[slot].wnext = first;
+        slab[slot].wprev = nil;
+        slab[slot].wpos = level * 64 + idx;
+        if (first != nil)
+            slab[first].wprev = slot;
+        wheel[level][idx] = slot;
+        occupied[level] |= 1ULL << idx;
+    }
+
+    void wheelunlink(uint32_t slot)
+    {
+        node &n = slab[slot];
+        int level = n.wpos / 64;
+        int idx = n.wpos % 64;
+        if (n.wprev != nil)
+            slab[n.wprev].wnext = n.wnext;
+        else
+            wheel[level][idx] = n.wnext;
+        if (n.wnext != nil)
+            slab[n.wnext].wprev = n.wprev;
+        if (wheel[level][idx] == nil)
+            occupied[level] &= ~(1ULL << idx);
+    }
+
+    // Moves the wheel forward to now, cascading and expiring every occupied
+    // slot it passes. Each entry is cascaded at most once per level and
+    // expired once, so the cost is amortised O(1) per entry.
+    void advance(uint64_t now)
+    {
+        while (timed > 0)
+        {
+            uint64_t next = UINT64_MAX;
+            for (int level = 0; level < wheellevels; level++)
+            {
+                if (!occupied[level])
+                    continue;
+                int shift = wheelbits * level;
+                uint64_t period = wheeltime >> shift;
+                int r = (period + 1) & 63;
+                uint64_t rot = r ? (occupied[level] >> r) | (occupied[level] << (64 - r)) : occupied[level];
+                next = min(next, (period + __builtin_ctzll(rot) + 1) << shift);
+            }
+            if (next > now)
+                break;
+
+            wheeltime = next;
+            for (int level = wheellevels - 1; level > 0; level--)
+            {
+                int shift = wheelbits * level;
+                if ((wheeltime & ((1ULL << shift) - 1)) != 0)
+                    continue;
+                int idx = (wheeltime >> shift) & 63;
+                uint32_t slot = wheel[level][idx];
+                wheel[level][idx] = nil;
+                occupied[level] &= ~(1ULL << idx);
+                while (slot != nil)
+                {
+                    uint32_t nxt = slab[slot].wnext;
+                    wheelinsert(slot);
+                    slot = nxt;
+                }
+            }
+            uint32_t slot;
+            while ((slot = wheel[0][wheeltime & 63]) != nil)
+            {
+                removeentry(slot);
+                METRICS(counters.expirations++;)
+            }
+        }
+        wheeltime = max(wheeltime, now);
+    }
+
+    // Arms (ttl > 0) or clears the expiry of slot's entry.
+    void settimer(uint32_t slot, chrono::milliseconds ttl, uint64_t now)
+    {
+        if (slab[slot].deadline)
+        {
+            wheelunlink(slot);
+            timed--;
+        }
+        slab[slot].deadline = 0;
+        if (ttl.count() > 0)
+        {
+            slab[slot].deadline = now + ttl.count();
+            wheelinsert(slot);
+            timed++;
+        }
+    }
+
+    bool expired(uint32_t slot)
+    {
+        return slab[slot].deadline && slab[slot].deadline <= clock();
+    }
+
+    uint32_t claimslot()
+    {
+        if (freelist != nil)
+        {
+            uint32_t slot = freelist;
+            freelist = slab[slot].next;
+            return slot;
+        }
+        slab.emplace_back();
+        return slab.size() - 1;
+    }
+
+    // Unlinks slot from the list and the wheel and recycles it; the caller
+    // owns the map entry.
+    void dropslot(uint32_t slot)
+    {
+        deletenode(slot);
+        if (slab[slot].deadline)
+        {
+            wheelunlink(slot);
+            slab[slot].deadline = 0;
+            timed--;
+        }
+        total -= slab[slot].weight;
+        slab[slot].kv.reset();
+        slab[slot].next = freelist;
+        freelist = slot;
+    }
+
+    void removeentry(uint32_t slot)
+    {
+        m.erase(slab[slot].kv->first);
+        dropslot(slot);
+    }
+
+    void evictlru()
+    {
+        removeentry(slab[tail].prev);
+        METRICS(counters.evictions++;)
+    }
+
+    // Gives a key that was just inserted into m its slot, evicting from the
+    // tail until the new entry fits. An entry heavier than the whole capacity
+    // is still admitted, alone, and goes at the next insertion.
+    uint32_t admit(typename maptype::iterator it, V &&value)
+    {
+        size_t w = weigher(it->first, value);
+        while (total + w > cap && slab[tail].prev != head)
+            evictlru();
+
+        uint32_t slot = claimslot();
+        slab[slot].kv.emplace(it->first, move(value));
+        slab[slot].weight = w;
+        total += w;
+        it->second = slot;
+        addnode(slot);
+        return slot;
+    }
+
+    // Returns the cached value, or nullptr on a miss. An expired entry is
+    // dropped here and reported as a miss.
+    V *get(const K &key_)
+    {
+        METRICS(SampledTimer timer(counters.getlatency);)
+        auto it = m.find(key_);
+        if (it == m.end())
+        {
+            METRICS(counters.misses++;)
+            return nullptr;
+        }
+
+        uint32_t slot = it->second;
+        if (expired(slot))
+        {
+            m.erase(it);
+            dropslot(slot);
+            METRICS(counters.expirations++; counters.misses++;)
+            return nullptr;
+        }
+        movetofront(slot);
+        METRICS(counters.hits++;)
+        return &slab[slot].kv->second;
+    }
+
+    // Batched lookups and inserts run in chunks of this many keys: enough to
+    // overlap a chunk's cache misses, few enough that the prefetched lines
+    // are still in L1 when they are used.
+    static constexpr size_t batchchunk = 32;
+
+    // Stores each key's map bucket in buckets[i] and prefetches that bucket
+    // and its first node. std::unordered_map does not expose its bucket
+    // array, but bucket() is pure arithmetic and begin(bucket) a single
+    // independent load, so the loads for the whole chunk are in flight
+    // together.
+    void prefetchbuckets(const K *keys, size_t n, size_t *buckets)
+    {
+        for (size_t i = 0; i < n; i++)
+        {
+            buckets[i] = m.bucket(keys[i]);
+            auto lit = m.begin(buckets[i]);
+            if (lit != m.end(buckets[i]))
+                __builtin_prefetch(&*lit);
+        }
+    }
+
+    // The slot of key_ if it is in bucket b, else nil. Walks the chain
+    // prefetchbuckets already started loading, without hashing key_ again.
+    uint32_t findinbucket(const K &key_, size_t b) const
+    {
+        for (auto lit = m.begin(b); lit != m.end(b); ++lit)
+            if (m.key_eq()(lit->first, key_))
+                return lit->second;
+        return nil;
+    }
+
+    // out[i] = get(keys[i]) for the whole batch; returns the number of hits.
+    // Each chunk is looked up in three passes: prefetch buckets, walk them
+    // and prefetch slab nodes, then splice hits to the front. Every key is
+    // hashed and probed once, and the list writes in the last pass no longer
+    // sit between one probe and the next.
+    size_t get_many(const K *keys, size_t n, V **out)
+    {
+        size_t buckets[batchchunk];
+        uint32_t slots[batchchunk];
+        uint64_t now = timed ? clock() : 0;
+        size_t hits = 0;
+        for (size_t base = 0; base < n; base += batchchunk)
+        {
+            size_t len = min(batchchunk, n - base);
+            if (m.bucket_count() == 0)
+            {
+                fill(out + base, out + base + len, nullptr);
+                METRICS(counters.misses += len;)
+                continue;
+            }
+            prefetchbuckets(keys + base, len, buckets);
+            for (size_t i = 0; i < len; i++)
+            {
+                slots[i] = findinbucket(keys[base + i], buckets[i]);
+                if (slots[i] != nil)
+                    __builtin_prefetch(&slab[slots[i]]);
+            }
+            for (size_t i = 0; i < len; i++)
+            {
+                uint32_t slot = slots[i];
+                // A duplicate of a key that expired earlier in this chunk
+                // points at a slot that has since been recycled.
+                if (slot == nil || !slab[slot].kv)
+                {
+                    out[base + i] = nullptr;
+                    METRICS(counters.misses++;)
+                    continue;
+                }
+                if (slab[slot].deadline && slab[slot].deadline <= now)
+                {
+                    removeentry(slot);
+                    out[base + i] = nullptr;
+                    METRICS(counters.expirations++; counters.misses++;)
+                    continue;
+                }
+                movetofront(slot);
+                METRICS(counters.hits++;)
+                out[base + i] = &slab[slot].kv->second;
+                hits++;
+            }
+        }
+        return hits;
+    }
+
+    // put(keys[i], values[i], ttl) for the whole batch, moving from values.
+    // Buckets are prefetched a chunk at a time before the puts are applied
+    // in order, so the result matches the sequential loop. Only the buckets:
+    // finding the nodes too would probe every key twice, since put has to
+    // go through try_emplace anyway.
+    void put_many(const K *keys, V *values, size_t n, chrono::milliseconds ttl = chrono::milliseconds::zero())
+    {
+        size_t buckets[batchchunk];
+        for (size_t base = 0; base < n; base += batchchunk)
+        {
+            size_t len = min(batchchunk, n - base);
+            if (m.bucket_count())
+                prefetchbuckets(keys + base, len, buckets);
+            for (size_t i = 0; i < len; i++)
+                put(keys[base + i], move(values[base + i]), ttl);
+        }
+    }
+
+    void clear()
+    {
+        m.clear();
+        slab.resize(2);
+        slab[head].next = tail;
+        slab[tail].prev = head;
+        freelist = nil;
+        total = 0;
+        timed = 0;
+        for (auto &level : wheel)
+            fill(begin(level), end(level), nil);
+        fill(begin(occupied), end(occupied), 0);
+    }
+
+    // Writes the live entries to path in recency order (through a temporary
+    // file renamed into place). Needs trivially copyable keys and values.
+    bool save(const char *path)
+    {
+        static_assert(is_trivially_copyable<K>::value && is_trivially_copyable<V>::value,
+                      "snapshots store keys and values as raw bytes");
+
+        string tmp = string(path) + ".tmp";
+        FILE *f = fopen(tmp.c_str(), "wb");
+        if (!f)
+        {
+            cerr << "Failed to create snapshot " << tmp << endl;
+            return false;
+        }
+        setvbuf(f, nullptr, _IOFBF, 1 << 20);
+
+        snapshotheader hdr = {{'L', 'R', 'U', 'S', 'N', 'A', 'P', 0}, 1, sizeof(K), sizeof(V), 0, 0};
+        fwrite(&hdr, sizeof(hdr), 1, f);
+        uint64_t now = timed ? clock() : 0;
+        for (uint32_t slot = slab[head].next; slot != tail; slot = slab[slot].next)
+        {
+            const node &n = slab[slot];
+            if (n.deadline && n.deadline <= now)
+                continue;
+            uint64_t ttl = n.deadline ? n.deadline - now : 0;
+            fwrite(&n.kv->first, sizeof(K), 1, f);
+            fwrite(&n.kv->second, sizeof(V), 1, f);
+            fwrite(&ttl, sizeof(ttl), 1, f);
+            hdr.count++;
+        }
+        fseek(f, 0, SEEK_SET);
+        fwrite(&hdr, sizeof(hdr), 1, f);
+        bool ok = !ferror(f);
+        ok = fclose(f) == 0 && ok;
+        if (!ok || rename(tmp.c_str(), path) != 0)
+        {
+            cerr << "Failed to write snapshot " << path << endl;
+            remove(tmp.c_str());
+            return false;
+        }
+        return true;
+    }
+
+    // Replaces the cache contents with a snapshot written by save(). The file
+    // is mapped rather than read, and the map, slab and list are rebuilt in
+    // one pass from most to least recent; if the snapshot holds more than
+    // this cache's capacity, the most recent entries are kept.
+    bool load(const char *path)
+    {
+        static_assert(is_trivially_copyable<K>::value && is_trivially_copyable<V>::value,
+                      "snapshots store keys and values as raw bytes");
+
+        int fd = open(path, O_RDONLY);
+        if (fd < 0)
+        {
+            cerr << "Failed to open snapshot " << path << endl;
+            return false;
+        }
+        struct stat st;
+        if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(snapshotheader))
+        {
+            cerr << "Failed to read snapshot " << path << endl;
+            close(fd);
+            return false;
+        }
+        void *base = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        close(fd);
+        if (base == MAP_FAILED)
+        {
+            cerr << "Failed to map snapshot " << path << endl;
+            return false;
+        }
+        // Advice values are not flags: one call each
+        madvise(base, st.st_size, MADV_SEQUENTIAL);
+        madvise(base, st.st_size, MADV_WILLNEED);
+
+        snapshotheader hdr;
+        memcpy(&hdr, base, sizeof(hdr));
+        const size_t record = sizeof(K) + sizeof(V) + sizeof(uint64_t);
+        if (memcmp(hdr.magic, "LRUSNAP", 8) != 0 || hdr.version != 1 || hdr.keysize != sizeof(K) ||
+            hdr.valsize != sizeof(V) || hdr.count > (st.st_size - sizeof(hdr)) / record)
+        {
+            cerr << "Snapshot " << path << " does not match this cache's key/value types" << endl;
+            munmap(base, st.st_size);
+            return false;
+        }
+
+        clear();
+        m.reserve(min<uint64_t>(hdr.count, is_same<Weigher, unitweight>::value ? cap : hdr.count));
+        // The wheel must start at now before any timer goes in: a fresh
+        // cache's wheeltime of 0 would park every deadline at the top level
+        uint64_t now = clock();
+        wheeltime = max(wheeltime, now);
+        const char *p = (const char *)base + sizeof(hdr);
+        for (uint64_t i = 0; i < hdr.count; i++, p += record)
+        {
+            K key_;
+            V value;
+            uint64_t ttl;
+            memcpy(&key_, p, sizeof(K));
+            memcpy(&value, p + sizeof(K), sizeof(V));
+            memcpy(&ttl, p + sizeof(K) + sizeof(V), sizeof(ttl));
+
+            size_t w = weigher(key_, value);
+            if (cap == 0 || (total + w > cap && !m.empty()))
+                break;
+            auto res = m.try_emplace(key_, nil);
+            if (!res.second)
+                continue;
+
+            uint32_t slot = claimslot();
+            slab[slot].kv.emplace(key_, value);
+            slab[slot].weight = w;
+            total += w;
+            res.first->second = slot;
+            addnodeback(slot);
+            if (ttl)
+                settimer(slot, chrono::milliseconds(ttl), now);
+        }
+        munmap(base, st.st_size);
+        return true;
+    }
+
+    // A positive ttl makes the entry expire that long after this call; a put
+    // without one leaves the entry (or the overwritten entry) immortal.
+    void put(const K &key_, V value, chrono::milliseconds ttl = chrono::milliseconds::zero())
+    {
+        METRICS(SampledTimer timer(counters.putlatency);)
+        if (cap == 0)
+            return;
+
+        uint64_t now = 0;
+        if (ttl.count() > 0 || timed > 0)
+        {
+            now = clock();
+            advance(now);
+        }
+
+        auto res = m.try_emplace(key_, nil);
+        if (!res.second)
+        {
+            uint32_t slot = res.first->second;
+            total -= slab[slot].weight;
+            slab[slot].weight = weigher(key_, value);
+            total += slab[slot].weight;
+            slab[slot].kv->second = move(value);
+            settimer(slot, ttl, now);
+            movetofront(slot);
+            while (total > cap && slab[tail].prev != slot)
+                evictlru();
+            METRICS(counters.updates++;)
+            return;
+        }
+
+        settimer(admit(res.first, move(value)), ttl, now);
+        METRICS(counters.inserts++;)
+    }
+
+    // Read-through lookup: returns the cached value, or calls loader(key_),
+    // caches its result (with an optional ttl) and returns it. Hits and
+    // misses both cost a single hash probe; if the loader throws, the cache
+    // is left unchanged. A zero-capacity cache caches nothing: the loaded
+    // value is returned from a holder that the next call overwrites.
+    template <typename Loader>
+    V &get_or_insert(const K &key_, Loader loader, chrono::milliseconds ttl = chrono::milliseconds::zero())
+    {
+        if (cap == 0)
+        {
+            METRICS(counters.misses++;)
+            uncached.emplace(loader(key_));
+            return *uncached;
+        }
+
+        uint64_t now = 0;
+        if (ttl.count() > 0 || timed > 0)
+        {
+            now = clock();
+            advance(now);
+        }
+
+        auto res = m.try_emplace(key_, nil);
+        if (!res.second)
+        {
+            uint32_t slot = res.first->second;
+            if (!expired(slot))
+            {
+                movetofront(slot);
+                METRICS(counters.hits++;)
+                return slab[slot].kv->second;
+            }
+            dropslot(slot);
+            res.first->second = nil;
+            METRICS(counters.expirations++;)
+        }
+
+        METRICS(counters.misses++;)
+        try
+        {
+            uint32_t slot = admit(res.first, loader(key_));
+            settimer(slot, ttl, now);
+            METRICS(counters.inserts++;)
+            return slab[slot].kv->second;
+        }
+        catch (...)
+        {
+            if (res.first->second == nil)
+                m.erase(res.first);
+            throw;
+        }
+    }
+};
+
+// Concurrent front-end for LRUCache. The key space is split across a
+// power-of-two number of shards, each guarding its own LRUCache (map, list
+// and capacity) with its own mutex, so threads touching different shards
+// never contend. Recency is tracked per shard, which approximates global LRU
+// closely once each shard holds more than a handful of entries.
+template <typename K, typename V, typename Hash = hash<K>, typename Weigher = unitweight>
+class ShardedLRUCache
+{
+public:
+    struct alignas(64) shard
+    {
+        mutex mtx;
+        LRUCache<K, V, Hash, Weigher> cache;
+        shard(size_t capacity, const Weigher &weigher, const Hash &hash_) : cache(capacity, weigher, hash_) {}
+    };
+
+    vector<unique_ptr<shard>> shards;
+    unsigned mask;
+    Hash hasher;
+
+    ShardedLRUCache(size_t capacity, int nshards = 16, Weigher weigher = Weigher(), Hash hash_ = Hash())
+        : hasher(hash_)
+    {
+        unsigned n = 1;
+        while (n < (unsigned)max(nshards, 1))
+            n <<= 1;
+        mask = n - 1;
+        // Shard capacities add up to exactly capacity; the first capacity % n
+        // shards take one unit more than the rest.
+        for (unsigned i = 0; i < n; i++)
+            shards.push_back(make_unique<shard>(capacity / n + (i < capacity % n), weigher, hash_));
+    }
+
+    shard &shardfor(const K &key_)
+    {
+        return *shards[mix64(hasher(key_)) & mask];
+    }
+
+    // Copies the value out, since it may be evicted once the lock is dropped.
+    optional<V> get(const K &key_)
+    {
+        shard &s = shardfor(key_);
+        lock_guard<mutex> lock(s.mtx);
+        V *v = s.cache.get(key_);
+        if (!v)
+            return nullopt;
+        return *v;
+    }
+
+    // Runs f(value) under the shard lock, for values too large to copy out.
+    template <typename F>
+    bool visit(const K &key_, F f)
+    {
+        shard &s = shardfor(key_);
+        lock_guard<mutex> lock(s.mtx);
+        V *v = s.cache.get(key_);
+        if (!v)
+            return false;
+        f(*v);
+        return true;
+    }
+
+    void put(const K &key_, V value, chrono::milliseconds ttl = chrono::milliseconds::zero())
+    {
+        shard &s = shardfor(key_);
+        lock_guard<mutex> lock(s.mtx);
+        s.cache.put(key_, move(value), ttl);
+    }
+
+    // Sum of every shard's counters and histograms.
+    CacheStats stats()
+    {
+        CacheStats res;
+        for (auto &s : shards)
+        {
+            lock_guard<mutex> lock(s->mtx);
+            res.merge(s->cache.stats());
+        }
+        return res;
+    }
+
+    // The loader runs under the shard lock, so concurrent misses on the same
+    // key load it once; keep loaders short or they stall the whole shard.
+    template <typename Loader>
+    V get_or_insert(const K &key_, Loader loader, chrono::milliseconds ttl = chrono::milliseconds::zero())
+    {
+        shard &s = shardfor(key_);
+        lock_guard<mutex> lock(s.mtx);
+        return s.cache.get_or_insert(key_, loader, ttl);
+    }
+};
+
+// Slab and key index shared by the scan-resistant policies below. Every entry
+// sits on one of nseg index-linked LRU lists ("segments"); the sentinels of
+// segment s are slots 2s and 2s + 1. ARC's ghost entries keep their key but
+// drop their value.
+template <typename K, typename V, typename Hash, int nseg>
+class SegmentedSlab
+{
+public:
+    class node
+    {
+    public:
+        optional<K> key;
+        optional<V> val;
+        uint32_t next = nil;
+        uint32_t prev = nil;
+        int seg = 0;
     };
 
-    node *head = new node(-1, -1);
-    node *tail = new node(-1, -1);
+    static constexpr uint32_t nil = UINT32_MAX;
+
+    vector<node> slab;
+    uint32_t freelist = nil;
+    size_t count[nseg] = {};
+    unordered_map<K, uint32_t, Hash> m;
+
+    SegmentedSlab(size_t entries, const Hash &hash_) : m(0, hash_)
+    {
+        slab.reserve(entries + 2 * nseg);
+        slab.resize(2 * nseg);
+        for (uint32_t i = 0; i < 2 * nseg; i += 2)
+        {
+            slab[i].next = i + 1;
+            slab[i + 1].prev = i;
+        }
+        m.reserve(entries + 1);
+    }
+
+    // LRU entry of segment seg_, or nil if it is empty.
+    uint32_t back(int seg_) const
+    {
+        uint32_t slot = slab[2 * seg_ + 1].prev;
+        return slot == (uint32_t)(2 * seg_) ? nil : slot;
+    }
+
+    void pushfront(int seg_, uint32_t slot)
+    {
+        uint32_t first = slab[2 * seg_].next;
+        slab[slot].next = first;
+        slab[slot].prev = 2 * seg_;
+        slab[2 * seg_].next = slot;
+        slab[first].prev = slot;
+        slab[slot].seg = seg_;
+        count[seg_]++;
+    }
+
+    void unlink(uint32_t slot)
+    {
+        uint32_t delprev = slab[slot].prev;
+        uint32_t delnext = slab[slot].next;
+        slab[delprev].next = delnext;
+        slab[delnext].prev = delprev;
+        count[slab[slot].seg]--;
+    }
+
+    void moveto(int seg_, uint32_t slot)
+    {
+        unlink(slot);
+        pushfront(seg_, slot);
+    }
+
+    uint32_t claim(const K &key_)
+    {
+        uint32_t slot;
+        if (freelist != nil)
+        {
+            slot = freelist;
+            freelist = slab[slot].next;
+        }
+        else
+        {
+            slot = slab.size();
+            slab.emplace_back();
+        }
+        slab[slot].key.emplace(key_);
+        return slot;
+    }
+
+    // Unlinks slot, drops its key from the index and recycles it.
+    void release(uint32_t slot)
+    {
+        unlink(slot);
+        m.erase(*slab[slot].key);
+        slab[slot].key.reset();
+        slab[slot].val.reset();
+        slab[slot].next = freelist;
+        freelist = slot;
+    }
+
+    uint64_t keyhash(uint32_t slot) const
+    {
+        return mix64(m.hash_function()(*slab[slot].key));
+    }
+};
 
-    int cap;
-    unordered_map<int, node *> m;
+// Segmented LRU: new entries start on a probation segment and are promoted to
+// the protected segment (80% of capacity) on their first hit, so a scan of
+// one-hit keys only ever churns probation.
+template <typename K, typename V, typename Hash = hash<K>>
+class SLRUCache
+{
+public:
+    enum { probation, protect };
 
-    LRUCache(int capacity)
+    size_t cap;
+    size_t protcap;
+    SegmentedSlab<K, V, Hash, 2> s;
+
+    explicit SLRUCache(size_t capacity, Hash hash_ = Hash())
+        : cap(capacity), protcap(capacity * 4 / 5), s(capacity, hash_) {}
+
+    size_t size() const
     {
-        cap = capacity;
-        head->next = tail;
-        tail->prev = head;
+        return s.m.size();
     }
 
-    void addnode(node *newnode)
+    void touch(uint32_t slot)
     {
-        node *temp = head->next;
-        newnode->next = temp;
-        newnode->prev = head;
-        head->next = newnode;
-        temp->prev = newnode;
+        bool promoted = s.slab[slot].seg == probation;
+        s.moveto(protect, slot);
+        if (promoted && s.count[protect] > protcap)
+            s.moveto(probation, s.back(protect));
     }
 
-    void deletenode(node *delnode)
+    V *get(const K &key_)
     {
-        node *delprev = delnode->prev;
-        node *delnext = delnode->next;
-        delprev->next = delnext;
-        delnext->prev = delprev;
+        auto it = s.m.find(key_);
+        if (it == s.m.end())
+            return nullptr;
+
+        touch(it->second);
+        return &*s.slab[it->second].val;
     }
 
-    int get(int key_)
+    void put(const K &key_, V value)
     {
-        if (m.find(key_) != m.end())
+        if (cap == 0)
+            return;
+
+        auto res = s.m.try_emplace(key_, s.nil);
+        if (!res.second)
+        {
+            *s.slab[res.first->second].val = move(value);
+            touch(res.first->second);
+            return;
+        }
+
+        if (s.m.size() > cap)
         {
-            node *resnode = m[key_];
-            int res = resnode->val;
-            m.erase(key_);
-            deletenode(resnode);
-            addnode(resnode);
-            m[key_] = head->next;
-            return res;
+            uint32_t victim = s.back(probation);
+            s.release(victim != s.nil ? victim : s.back(protect));
         }
 
-        return -1;
+        uint32_t slot = s.claim(key_);
+        res.first->second = slot;
+        s.slab[slot].val.emplace(move(value));
+        s.pushfront(probation, slot);
     }
+};
+
+// Adaptive Replacement Cache (Megiddo & Modha). T1 holds keys seen once, T2
+// keys seen at least twice, and the ghost lists B1/B2 remember the keys
+// recently evicted from each. A put that hits a ghost shifts the target size
+// p of T1 towards whichever list would have kept it. A get that misses
+// changes nothing: ARC's miss handling happens in the put that follows it.
+template <typename K, typename V, typename Hash = hash<K>>
+class ARCCache
+{
+public:
+    enum { t1, t2, b1, b2 };
 
-    void put(int key_, int value)
+    size_t cap;
+    size_t p = 0;
+    SegmentedSlab<K, V, Hash, 4> s;
+
+    explicit ARCCache(size_t capacity, Hash hash_ = Hash())
+        : cap(capacity), s(2 * capacity, hash_) {}
+
+    size_t size() const
     {
-        if (m.find(key_) != m.end())
+        return s.count[t1] + s.count[t2];
+    }
+
+    V *get(const K &key_)
+    {
+        auto it = s.m.find(key_);
+        if (it == s.m.end() || s.slab[it->second].seg >= b1)
+            return nullptr;
+
+        s.moveto(t2, it->second);
+        return &*s.slab[it->second].val;
+    }
+
+    // Demotes the LRU entry of T1 or T2 to its ghost list, dropping the value.
+    void replace(bool inb2)
+    {
+        uint32_t slot;
+        if (s.count[t1] > 0 && (s.count[t1] > p || (inb2 && s.count[t1] == p)))
         {
-            node *existingnode = m[key_];
-            m.erase(key_);
-            deletenode(existingnode);
+            slot = s.back(t1);
+            s.moveto(b1, slot);
         }
-        if (m.size() == cap)
+        else
         {
-            m.erase(tail->prev->key);
-            deletenode(tail->prev);
+            slot = s.back(t2);
+            s.moveto(b2, slot);
         }
+        s.slab[slot].val.reset();
+    }
 
-        addnode(new node(key_, value));
-        m[key_] = head->next;
+    void put(const K &key_, V value)
+    {
+        if (cap == 0)
+            return;
+
+        auto res = s.m.try_emplace(key_, s.nil);
+        if (!res.second)
+        {
+            uint32_t slot = res.first->second;
+            int seg = s.slab[slot].seg;
+            if (seg == b1)
+                p = min(cap, p + max(s.count[b2] / s.count[b1], (size_t)1));
+            else if (seg == b2)
+                p -= min(p, max(s.count[b1] / s.count[b2], (size_t)1));
+            if (seg == b1 || seg == b2)
+                replace(seg == b2);
+
+            s.slab[slot].val = move(value);
+            s.moveto(t2, slot);
+            return;
+        }
+
+        size_t l1 = s.count[t1] + s.count[b1];
+        size_t total = l1 + s.count[t2] + s.count[b2];
+        if (l1 == cap)
+        {
+            if (s.count[t1] < cap)
+            {
+                s.release(s.back(b1));
+                replace(false);
+            }
+            else
+            {
+                s.release(s.back(t1));
+            }
+        }
+        else if (total >= cap)
+        {
+            if (total == 2 * cap)
+                s.release(s.back(b2));
+            replace(false);
+        }
+
+        uint32_t slot = s.claim(key_);
+        res.first->second = slot;
+        s.slab[slot].val.emplace(move(value));
+        s.pushfront(t1, slot);
     }
 };
 
-int main()
+// Count-min sketch of 4-bit counters, four rows deep. Once it has counted ten
+// times as many events as the cache holds, every counter is halved so the
+// estimates follow recent popularity rather than all-time totals.
+class CountMinSketch
 {
-    LRUCache lru(2);
+public:
+    vector<uint64_t> table;
+    size_t width;
+    size_t additions = 0;
+    size_t samplesize;
+
+    explicit CountMinSketch(size_t entries)
+    {
+        width = 16;
+        while (width < entries)
+            width <<= 1;
+        table.assign(4 * width / 16, 0);
+        samplesize = 10 * max(entries, (size_t)1);
+    }
+
+    size_t counterindex(uint64_t h, int row) const
+    {
+        return row * width + (mix64(h + row * 0x9e3779b97f4a7c15ULL) & (width - 1));
+    }
+
+    int frequency(uint64_t h) const
+    {
+        int freq = 15;
+        for (int row = 0; row < 4; row++)
+        {
+            size_t i = counterindex(h, row);
+            freq = min(freq, (int)(table[i >> 4] >> ((i & 15) * 4)) & 15);
+        }
+        return freq;
+    }
+
+    void increment(uint64_t h)
+    {
+        bool added = false;
+        for (int row = 0; row < 4; row++)
+        {
+            size_t i = counterindex(h, row);
+            int shift = (i & 15) * 4;
+            if (((table[i >> 4] >> shift) & 15) < 15)
+            {
+                table[i >> 4] += 1ULL << shift;
+                added = true;
+            }
+        }
+        if (added && ++additions == samplesize)
+        {
+            for (auto &w : table)
+                w = (w >> 1) & 0x7777777777777777ULL;
+            additions /= 2;
+        }
+    }
+};
+
+// W-TinyLFU: a small LRU window (1% of capacity) in front of a segmented LRU
+// main region. A key leaving the window only displaces the main region's
+// victim if the frequency sketch has seen it more often, so scans and
+// one-hit wonders never push out the frequently used set.
+template <typename K, typename V, typename Hash = hash<K>>
+class TinyLFUCache
+{
+public:
+    enum { window, probation, protect };
+
+    size_t cap;
+    size_t wincap;
+    size_t protcap;
+    SegmentedSlab<K, V, Hash, 3> s;
+    CountMinSketch sketch;
+
+    explicit TinyLFUCache(size_t capacity, Hash hash_ = Hash())
+        : cap(capacity), s(capacity, hash_), sketch(capacity)
+    {
+        wincap = max(cap / 100, (size_t)1);
+        protcap = (cap - min(cap, wincap)) * 4 / 5;
+    }
+
+    size_t size() const
+    {
+        return s.m.size();
+    }
+
+    void touch(uint32_t slot)
+    {
+        int seg = s.slab[slot].seg;
+        s.moveto(seg == window ? window : protect, slot);
+        if (seg == probation && s.count[protect] > protcap)
+            s.moveto(probation, s.back(protect));
+    }
+
+    V *get(const K &key_)
+    {
+        sketch.increment(mix64(s.m.hash_function()(key_)));
+        auto it = s.m.find(key_);
+        if (it == s.m.end())
+            return nullptr;
+
+        touch(it->second);
+        return &*s.slab[it->second].val;
+    }
+
+    // Moves the window's LRU entry into probation; if the main region is now
+    // over budget, the candidate and the main region's victim compete on
+    // sketch frequency and the loser is evicted.
+    void evict()
+    {
+        uint32_t cand = s.back(window);
+        s.moveto(probation, cand);
+        if (s.count[probation] + s.count[protect] <= cap - wincap)
+            return;
+
+        uint32_t victim = s.back(probation);
+        if (victim == cand)
+            victim = s.back(protect);
+        if (victim == s.nil || sketch.frequency(s.keyhash(cand)) <= sketch.frequency(s.keyhash(victim)))
+            victim = cand;
+        s.release(victim);
+    }
+
+    void put(const K &key_, V value)
+    {
+        sketch.increment(mix64(s.m.hash_function()(key_)));
+        if (cap == 0)
+            return;
+
+        auto res = s.m.try_emplace(key_, s.nil);
+        if (!res.second)
+        {
+            *s.slab[res.first->second].val = move(value);
+            touch(res.first->second);
+            return;
+        }
+
+        uint32_t slot = s.claim(key_);
+        res.first->second = slot;
+        s.slab[slot].val.emplace(move(value));
+        s.pushfront(window, slot);
+        if (s.count[window] > wincap)
+            evict();
+    }
+};
+
+// Approximate LRU (CLOCK, a.k.a. second chance) for read-mostly concurrent
+// use. get takes no lock: it pins an epoch, walks its bucket's chain with
+// acquire loads and, on a hit, sets the entry's atomic reference bit. The
+// capacity is fixed, so the bucket array is sized once and never moves.
+// Entries are immutable apart from that bit; put serializes writers on a
+// mutex, publishes a new node for an insert or an update, and retires the
+// node it replaces or evicts to the EpochDomain, so a reader still on it
+// can finish safely. Once the cache is full the clock hand sweeps forward,
+// clearing set bits, and evicts the first entry whose bit is already clear.
+template <typename K, typename V, typename Hash = hash<K>>
+class ClockCache
+{
+public:
+    struct node
+    {
+        pair<K, V> kv;
+        uint32_t slot;
+        atomic<uint8_t> ref{0};
+        atomic<node *> next;
+        node(const K &k, V &&v, uint32_t slot_, node *n) : kv(k, move(v)), slot(slot_), next(n) {}
+    };
+
+    size_t cap;
+    size_t used = 0;
+    size_t hand = 0;
+    size_t mask;
+    unique_ptr<node *[]> ring;           // clock slots; writers only
+    unique_ptr<atomic<node *>[]> heads;  // bucket chains
+    Hash hasher;
+    mutable mutex mtx;                   // serializes writers
+
+    explicit ClockCache(size_t capacity, Hash hash_ = Hash())
+        : cap(capacity), ring(new node *[capacity]), hasher(hash_)
+    {
+        size_t n = 1;
+        while (n < capacity)
+            n <<= 1;
+        mask = n - 1;
+        heads.reset(new atomic<node *>[n]);
+        for (size_t b = 0; b < n; b++)
+            heads[b].store(nullptr, memory_order_relaxed);
+    }
+
+    ClockCache(const ClockCache &) = delete;
+    ClockCache &operator=(const ClockCache &) = delete;
+
+    ~ClockCache()
+    {
+        for (size_t i = 0; i < used; i++)
+            delete ring[i];
+    }
+
+    size_t size() const
+    {
+        lock_guard<mutex> lock(mtx);
+        return used;
+    }
+
+    // Runs f(value) on a hit, with no lock held; the value stays alive
+    // until f returns even if a writer replaces or evicts it meanwhile.
+    template <typename F>
+    bool visit(const K &key_, F f)
+    {
+        EpochGuard guard;
+        for (node *n = heads[bucketof(key_)].load(memory_order_acquire); n != nullptr;
+             n = n->next.load(memory_order_acquire))
+        {
+            if (n->kv.first == key_)
+            {
+                // Skip the store when the bit is already set so hot entries
+                // do not bounce their cache line between reader cores.
+                if (!n->ref.load(memory_order_relaxed))
+                    n->ref.store(1, memory_order_relaxed);
+                f(as_const(n->kv.second));
+                return true;
+            }
+        }
+        return false;
+    }
+
+    optional<V> get(const K &key_)
+    {
+        optional<V> res;
+        visit(key_, [&res](const V &v)
+              { res = v; });
+        return res;
+    }
+
+    void put(const K &key_, V value)
+    {
+        if (cap == 0)
+            return;
+
+        lock_guard<mutex> lock(mtx);
+        atomic<node *> *link = findlink(key_);
+        if (node *old = link->load(memory_order_relaxed))
+        {
+            node *n = new node(key_, move(value), old->slot, old->next.load(memory_order_relaxed));
+            n->ref.store(1, memory_order_relaxed);
+            ring[n->slot] = n;
+            link->store(n, memory_order_release);
+            EpochDomain::global().retire(old, deletenode);
+            return;
+        }
+
+        uint32_t slot;
+        if (used < cap)
+        {
+            slot = used++;
+        }
+        else
+        {
+            while (ring[hand]->ref.load(memory_order_relaxed))
+            {
+                ring[hand]->ref.store(0, memory_order_relaxed);
+                hand = (hand + 1) % cap;
+            }
+            slot = hand;
+            hand = (hand + 1) % cap;
+            node *victim = ring[slot];
+            findlink(victim->kv.first)->store(victim->next.load(memory_order_relaxed), memory_order_release);
+            EpochDomain::global().retire(victim, deletenode);
+        }
+        // At the head of the chain, so the eviction above cannot have
+        // unlinked the node this one would hang from
+        atomic<node *> &head = heads[bucketof(key_)];
+        node *n = new node(key_, move(value), slot, head.load(memory_order_relaxed));
+        ring[slot] = n;
+        head.store(n, memory_order_release);
+    }
+
+private:
+    static void deletenode(void *p, void *)
+    {
+        delete (node *)p;
+    }
+
+    size_t bucketof(const K &key_) const
+    {
+        return mix64(hasher(key_)) & mask;
+    }
+
+    // The link holding key_'s node, or the null one ending its chain.
+    // Writers only, under mtx.
+    atomic<node *> *findlink(const K &key_)
+    {
+        atomic<node *> *link = &heads[bucketof(key_)];
+        for (node *n = link->load(memory_order_relaxed); n != nullptr && !(n->kv.first == key_);
+             n = link->load(memory_order_relaxed))
+            link = &n->next;
+        return link;
+    }
+};
+
+// Runs nthreads workers issuing a 90/10 get/put mix over keyrange keys and
+// returns the aggregate throughput in Mops/s.
+template <typename Cache>
+double runmix(Cache &cache, int nthreads, int keyrange, int opsperthread)
+{
+    vector<thread> workers;
+    atomic<long long> checksum{0};
+    auto start = chrono::steady_clock::now();
+    for (int t = 0; t < nthreads; t++)
+    {
+        workers.emplace_back([&, t]()
+        {
+            mt19937 rng(t + 1);
+            uniform_int_distribution<int> keys(0, keyrange - 1);
+            long long sum = 0;
+            for (int i = 0; i < opsperthread; i++)
+            {
+                int k = keys(rng);
+                if (i % 10 == 0)
+                    cache.put(k, i);
+                else if (auto v = cache.get(k))
+                    sum += *v;
+            }
+            checksum += sum;
+        });
+    }
+    for (auto &w : workers)
+        w.join();
+    double secs = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    return (double)nthreads * opsperthread / secs / 1e6;
+}
+
+// Multi-threaded scaling benchmark over a key range twice the cache
+// capacity. A single shard is the "one global mutex" baseline; the clock
+// column is ClockCache, whose readers take no lock.
+void benchsharded()
+{
+    const int capacity = 1 << 20;
+    const int keyrange = capacity * 2;
+    const int opsperthread = 1000000;
+    int maxthreads = max(32u, thread::hardware_concurrency());
+
+    cout << "threads";
+    for (int nshards : {1, 16, 64})
+        cout << "\tshards=" << nshards;
+    cout << "\tclock\t(Mops/s)" << endl;
+
+    for (int nthreads = 1; nthreads <= maxthreads; nthreads *= 2)
+    {
+        cout << nthreads << fixed << setprecision(2);
+        for (int nshards : {1, 16, 64})
+        {
+            ShardedLRUCache<int, int> cache(capacity, nshards);
+            for (int k = 0; k < capacity; k++)
+                cache.put(k, k);
+            cout << "\t" << runmix(cache, nthreads, keyrange, opsperthread);
+        }
+        ClockCache<int, int> clockcache(capacity);
+        for (int k = 0; k < capacity; k++)
+            clockcache.put(k, k);
+        cout << "\t" << runmix(clockcache, nthreads, keyrange, opsperthread) << endl;
+    }
+}
+
+// Batched vs single-key lookups on a cache far larger than the CPU caches.
+// Keys are uniform over the cached set, so every lookup is a hit that misses
+// in cache on both the map bucket and the slab node.
+void benchbatch()
+{
+    const int capacity = 1 << 22;
+    const size_t lookups = 1 << 24;
+    LRUCache<int, int> cache(capacity);
+    for (int k = 0; k < capacity; k++)
+        cache.put(k, k);
+
+    mt19937 rng(11);
+    uniform_int_distribution<int> dist(0, capacity - 1);
+    vector<int> keys(lookups);
+    for (auto &k : keys)
+        k = dist(rng);
+
+    cout << "batch\tloop (ns/key)\tget_many (ns/key)" << endl;
+    for (size_t batch : {8, 32, 128, 512})
+    {
+        long long sum = 0;
+        auto start = chrono::steady_clock::now();
+        for (size_t i = 0; i < lookups; i++)
+            if (int *v = cache.get(keys[i]))
+                sum += *v;
+        double loop = chrono::duration<double, nano>(chrono::steady_clock::now() - start).count() / lookups;
+
+        vector<int *> out(batch);
+        start = chrono::steady_clock::now();
+        for (size_t i = 0; i + batch <= lookups; i += batch)
+        {
+            cache.get_many(&keys[i], batch, out.data());
+            for (int *v : out)
+                if (v)
+                    sum -= *v;
+        }
+        double batched = chrono::duration<double, nano>(chrono::steady_clock::now() - start).count() / lookups;
+        cout << batch << "\t" << fixed << setprecision(1) << loop << "\t" << batched
+             << (sum ? "\t(checksum mismatch)" : "") << endl;
+    }
+}
+
+// Warm-restart timing: snapshot a populated cache, then load it into a fresh
+// one, as a restarted process would.
+void benchsnapshot(size_t entries)
+{
+    const char *path = "lru_snapshot.bin";
+    LRUCache<int, int> cache(entries);
+    for (size_t k = 0; k < entries; k++)
+        cache.put(k, k);
+
+    auto start = chrono::steady_clock::now();
+    if (!cache.save(path))
+        return;
+    double saved = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+
+    LRUCache<int, int> warm(entries);
+    start = chrono::steady_clock::now();
+    if (!warm.load(path))
+        return;
+    double loaded = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+
+    bool same = warm.size() == cache.size() && warm.slab[warm.slab[warm.head].next].kv->first == (int)entries - 1;
+    cout << entries << " entries: save " << fixed << setprecision(1) << saved << " ms, load " << loaded << " ms"
+         << (same ? "" : " (contents differ)") << endl;
+    remove(path);
+}
+
+void printstats(const CacheStats &st)
+{
+    if (!st.enabled)
+    {
+        cout << "metrics are compiled out; rebuild with -DENABLE_METRICS" << endl;
+        return;
+    }
+    cout << "hits " << st.hits << ", misses " << st.misses << " (hit ratio " << fixed << setprecision(2)
+         << 100 * st.hitratio() << "%)" << endl;
+    cout << "inserts " << st.inserts << ", updates " << st.updates << ", evictions " << st.evictions
+         << ", expirations " << st.expirations << endl;
+    for (auto op : {make_pair("get", &st.getlatency), make_pair("put", &st.putlatency)})
+        cout << op.first << " latency ns (sampled " << op.second->total << "): p50 " << op.second->percentile(50)
+             << ", p99 " << op.second->percentile(99) << ", p99.9 " << op.second->percentile(99.9)
+             << ", max " << op.second->maxvalue << endl;
+}
+
+// Read-through Zipf traffic against a cache holding 10% of the key space,
+// followed by a stats() snapshot.
+void demostats()
+{
+    const int keys = 1000000;
+    vector<double> cdf(keys);
+    double sum = 0;
+    for (int i = 0; i < keys; i++)
+        cdf[i] = sum += 1.0 / (i + 1);
+
+    LRUCache<int, int> cache(keys / 10);
+    mt19937 rng(3);
+    uniform_real_distribution<double> u(0, sum);
+    for (int i = 0; i < 5000000; i++)
+    {
+        int k = lower_bound(cdf.begin(), cdf.end(), u(rng)) - cdf.begin();
+        if (!cache.get(k))
+            cache.put(k, k, chrono::milliseconds(i % 100 == 0 ? 1 : 0));
+    }
+    printstats(cache.stats());
+}
+
+// Replays a key trace as read-through traffic (get, then put on a miss) and
+// prints the hit ratio, its difference from baseline (exact LRU's ratio, in
+// percentage points) and throughput. Returns the hit ratio.
+template <typename Cache>
+double replaytrace(const char *name, Cache &cache, const vector<uint32_t> &trace, double baseline)
+{
+    size_t hits = 0;
+    auto start = chrono::steady_clock::now();
+    for (uint32_t k : trace)
+    {
+        if (cache.get(k))
+            hits++;
+        else
+            cache.put(k, k);
+    }
+    double secs = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    double ratio = 100.0 * hits / max(trace.size(), (size_t)1);
+    cout << name << "\t" << fixed << setprecision(2) << ratio << "%\t" << showpos
+         << (baseline < 0 ? 0.0 : ratio - baseline) << noshowpos << "\t" << trace.size() / secs / 1e6 << endl;
+    return ratio;
+}
+
+// Synthetic trace: Zipf(0.99) traffic over a 20k-key hot set, interrupted
+// every 100k requests by a sequential scan of 20k never-repeated keys.
+vector<uint32_t> scantrace()
+{
+    const int hotkeys = 20000;
+    vector<double> cdf(hotkeys);
+    double sum = 0;
+    for (int i = 0; i < hotkeys; i++)
+        cdf[i] = sum += 1.0 / pow(i + 1, 0.99);
+
+    mt19937 rng(7);
+    uniform_real_distribution<double> u(0, sum);
+    vector<uint32_t> trace;
+    uint32_t cold = hotkeys;
+    for (int round = 0; round < 20; round++)
+    {
+        for (int i = 0; i < 100000; i++)
+            trace.push_back(lower_bound(cdf.begin(), cdf.end(), u(rng)) - cdf.begin());
+        for (int i = 0; i < 20000; i++)
+            trace.push_back(cold++);
+    }
+    return trace;
+}
+
+// ./lru_cache replay [trace-file [capacity]]: one key per whitespace-separated
+// token. Without a file, replays scantrace().
+void replay(int argc, char **argv)
+{
+    vector<uint32_t> trace;
+    size_t capacity = 2000;
+    if (argc > 2)
+    {
+        ifstream in(argv[2]);
+        if (!in)
+        {
+            cerr << "Failed to open trace " << argv[2] << endl;
+            return;
+        }
+        unordered_map<string, uint32_t> ids;
+        string token;
+        while (in >> token)
+            trace.push_back(ids.try_emplace(token, ids.size()).first->second);
+        capacity = argc > 3 ? stoul(argv[3]) : max(ids.size() / 100, (size_t)1);
+    }
+    else
+    {
+        trace = scantrace();
+    }
+
+    cout << trace.size() << " requests, capacity " << capacity << endl;
+    cout << "policy\thit ratio\tvs lru\tMops/s" << endl;
+    LRUCache<uint32_t, uint32_t> lru(capacity);
+    double base = replaytrace("lru", lru, trace, -1);
+    ClockCache<uint32_t, uint32_t> clockcache(capacity);
+    replaytrace("clock", clockcache, trace, base);
+    SLRUCache<uint32_t, uint32_t> slru(capacity);
+    replaytrace("slru", slru, trace, base);
+    ARCCache<uint32_t, uint32_t> arc(capacity);
+    replaytrace("arc", arc, trace, base);
+    TinyLFUCache<uint32_t, uint32_t> tinylfu(capacity);
+    replaytrace("tinylfu", tinylfu, trace, base);
+}
+
+// ./lru_cache suite [ops-per-thread]: read-through traffic (get, put on a
+// miss) with capacity for a quarter of the key space, over every workload in
+// bench.h. LRUCache is single-threaded, so it runs with one thread only;
+// ShardedLRUCache runs at every thread count. Prints JSON.
+void suite(size_t opsperthread)
+{
+    vector<BenchResult> results;
+    for (uint32_t keyspace : {1u << 12, 1u << 16, 1u << 20})
+    {
+        for (Workload w : {Workload::uniform, Workload::zipf, Workload::scan})
+        {
+            auto single = makekeys(w, keyspace, 1, opsperthread);
+            LRUCache<int, int> lru(keyspace / 4);
+            results.push_back(runworkload("lru", w, keyspace, single, [&](int, size_t, uint32_t k)
+            {
+                if (lru.get(k))
+                    return true;
+                lru.put(k, k);
+                return false;
+            }));
+
+            for (int nthreads : benchthreads())
+            {
+                auto streams = makekeys(w, keyspace, nthreads, opsperthread);
+                ShardedLRUCache<int, int> sharded(keyspace / 4);
+                results.push_back(runworkload("sharded_lru", w, keyspace, streams, [&](int, size_t, uint32_t k)
+                {
+                    if (sharded.get(k))
+                        return true;
+                    sharded.put(k, k);
+                    return false;
+                }));
+            }
+        }
+    }
+    printjson(cout, "lru_cache", results);
+}
+
+int main(int argc, char **argv)
+{
+    if (argc > 1 && string(argv[1]) == "bench")
+    {
+        benchsharded();
+        return 0;
+    }
+    if (argc > 1 && string(argv[1]) == "batch")
+    {
+        benchbatch();
+        return 0;
+    }
+    if (argc > 1 && string(argv[1]) == "snapshot")
+    {
+        benchsnapshot(argc > 2 ? stoul(argv[2]) : 4000000);
+        return 0;
+    }
+    if (argc > 1 && string(argv[1]) == "stats")
+    {
+        demostats();
+        return 0;
+    }
+    if (argc > 1 && string(argv[1]) == "replay")
+    {
+        replay(argc, argv);
+        return 0;
+    }
+    if (argc > 1 && string(argv[1]) == "suite")
+    {
+        suite(argc > 2 ? stoul(argv[2]) : 1000000);
+        return 0;
+    }
+
+    LRUCache<int, int> lru(2);
+    auto show = [&lru](int key_)
+    {
+        int *v = lru.get(key_);
+        cout << (v ? *v : -1) << endl;
+    };
     lru.put(1, 1);
     lru.put(2, 2);
-    cout << lru.get(1) << endl;
+    show(1);
     lru.put(3, 3);
-    cout << lru.get(2) << endl;
+    show(2);
     lru.put(4, 4);
-    cout << lru.get(1) << endl;
-    cout << lru.get(3) << endl;
-    cout << lru.get(4) << endl;
+    show(1);
+    show(3);
+    show(4);
+
+    // Byte-budgeted cache of move-only values
+    auto bytes = [](const string &k, const unique_ptr<string> &v)
+    { return k.size() + v->size(); };
+    LRUCache<string, unique_ptr<string>, hash<string>, decltype(bytes)> blobs(10000, bytes);
+    blobs.put("a", make_unique<string>(6000, 'a'));
+    blobs.put("b", make_unique<string>(6000, 'b'));
+    cout << "blobs: " << blobs.size() << " entries, " << blobs.weight() << " bytes, a "
+         << (blobs.get("a") ? "cached" : "evicted") << endl;
+
+    // Per-entry time-to-live
+    LRUCache<int, int> ttlcache(4);
+    ttlcache.put(1, 10, chrono::milliseconds(20));
+    ttlcache.put(2, 20);
+    this_thread::sleep_for(chrono::milliseconds(30));
+    cout << "ttl: key 1 " << (ttlcache.get(1) ? "live" : "expired") << ", key 2 "
+         << (ttlcache.get(2) ? "live" : "expired") << endl;
+
+    // TTLs survive a snapshot and loaded entries still expire on time
+    LRUCache<int, int> timed(16);
+    for (int i = 0; i < 10; i++)
+        timed.put(i, i, chrono::milliseconds(20));
+    LRUCache<int, int> restored(16);
+    if (timed.save("lru_ttl_snapshot.bin") && restored.load("lru_ttl_snapshot.bin"))
+    {
+        size_t before = restored.size();
+        this_thread::sleep_for(chrono::milliseconds(100));
+        restored.put(100, 100);
+        cout << "ttl snapshot: " << before << " loaded, " << restored.size() << " left after expiry" << endl;
+    }
+    remove("lru_ttl_snapshot.bin");
+
+    // Zero capacity caches nothing, in the plain and the sharded cache alike
+    LRUCache<int, int> none(0);
+    none.put(1, 1);
+    int loaded = none.get_or_insert(2, [](int k)
+                                    { return k * 10; });
+    ShardedLRUCache<int, int> nosharded(0);
+    nosharded.put(1, 1);
+    cout << "zero capacity: " << none.size() << " entries, loaded " << loaded << ", sharded "
+         << (nosharded.get(1) ? "cached" : "empty") << endl;
     return 0;
-}
\ No newline at end of file
+}
@@ -1,7 +1,103 @@
 #include <bits/stdc++.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#include "bench.h"
+#include "epoch.h"
+#include "metrics.h"
 using namespace std;
 
-class MyHashMap {
+// Snapshot returned by MyHashMap::stats(). The displacement distribution is
+// gathered on demand by walking the table; the counters and histograms stay
+// zero (enabled == false) unless built with -DENABLE_METRICS.
+struct HashMapStats {
+    bool enabled = metricsenabled;
+    uint64_t hits = 0;       // gets that found the key
+    uint64_t misses = 0;     // gets that did not
+    uint64_t inserts = 0;
+    uint64_t updates = 0;
+    uint64_t removes = 0;
+    LatencyHistogram getlatency;
+    LatencyHistogram putlatency;
+    LatencyHistogram removelatency;
+    LatencyHistogram probelength;   // groups probed per lookup
+    size_t size = 0;
+    // displacements[n] = keys stored n probe steps past their home group, the
+    // open-addressing counterpart of a chain-length distribution
+    vector<size_t> displacements;
+};
+
+// Fixed-size node allocator. Nodes are carved from slabs taken from a
+// std::pmr memory resource (new/delete unless one is supplied), each slab
+// twice the size of the last up to MAXSLAB nodes. Freed nodes go on an
+// intrusive free list threaded through their own storage, so create and
+// destroy are a few instructions with no malloc call, and the most recently
+// freed (cache-hot) node is reused first. Nodes created back to back sit
+// next to each other in a slab. The arena's destructor hands whole slabs back
+// without visiting nodes, so T must be trivially destructible.
+template <typename T>
+class NodeArena {
+private:
+    static_assert(is_trivially_destructible_v<T>, "NodeArena frees slabs without running destructors");
+
+    union Cell {
+        Cell* next;
+        alignas(T) unsigned char storage[sizeof(T)];
+    };
+
+    static constexpr size_t FIRSTSLAB = 64;
+    static constexpr size_t MAXSLAB = 1 << 16;
+
+    pmr::memory_resource* upstream;
+    vector<pair<Cell*, size_t>> slabs;
+    Cell* freelist = nullptr;
+    Cell* bump = nullptr;     // next never-used cell of the newest slab
+    Cell* bumpend = nullptr;
+
+public:
+    explicit NodeArena(pmr::memory_resource* r = pmr::get_default_resource()) : upstream(r) {}
+
+    NodeArena(const NodeArena&) = delete;
+    NodeArena& operator=(const NodeArena&) = delete;
+
+    template <typename... Args>
+    T* create(Args&&... args) {
+        Cell* c = freelist;
+        if (c != nullptr) {
+            freelist = c->next;
+        } else {
+            if (bump == bumpend) {
+                size_t n = slabs.empty() ? FIRSTSLAB : min(slabs.back().second * 2, MAXSLAB);
+                bump = (Cell*)upstream->allocate(n * sizeof(Cell), alignof(Cell));
+                bumpend = bump + n;
+                slabs.push_back({bump, n});
+            }
+            c = bump++;
+        }
+        return new (c->storage) T(forward<Args>(args)...);
+    }
+
+    void destroy(T* p) {
+        Cell* c = reinterpret_cast<Cell*>(p);
+        c->next = freelist;
+        freelist = c;
+    }
+
+    ~NodeArena() {
+        for (auto& slab : slabs) {
+            upstream->deallocate(slab.first, slab.second * sizeof(Cell), alignof(Cell));
+        }
+    }
+};
+
+// Separate chaining over a fixed 10007-bucket table: the original MyHashMap,
+// kept as the baseline for the benchmarks. Nodes come from a NodeArena,
+// optionally backed by a caller's pmr resource.
+class ChainedHashMap {
 private:
     // Node structure for linked list to handle collisions
     struct Node {
@@ -14,14 +110,17 @@ private:
     // Size of the hash table
     static const int SIZE = 10007;  
     vector<Node*> table;
+    NodeArena<Node> nodes;
 
-    // Hash function
+    // Hash function; kept as the weak modulo baseline, but folded into
+    // [0, SIZE) so that negative keys do not index before the table
     int hash(int key) {
-        return key % SIZE;
+        int index = key % SIZE;
+        return index < 0 ? index + SIZE : index;
     }
 
 public:
-    MyHashMap() {
+    explicit ChainedHashMap(pmr::memory_resource* upstream = pmr::get_default_resource()) : nodes(upstream) {
         table.resize(SIZE, nullptr);
     }
 
@@ -39,7 +138,7 @@ public:
         }
 
         // If key doesn't exist, create new node
-        Node* newNode = new Node(key, value);
+        Node* newNode = nodes.create(key, value);
         newNode->next = table[index];
         table[index] = newNode;
     }
@@ -72,7 +171,7 @@ public:
                     // If node to remove is in the middle or end
                     prev->next = current->next;
                 }
-                delete current;
+                nodes.destroy(current);
                 return;
             }
             prev = current;
@@ -80,46 +179,2129 @@ public:
         }
     }
 
-    // Destructor to clean up memory
-    ~MyHashMap() {
-        for (int i = 0; i < SIZE; i++) {
-            Node* current = table[i];
-            while (current != nullptr) {
-                Node* temp = current;
-                current = current->next;
-                delete temp;
-            }
+    // No destructor needed: the arena frees the nodes a slab at a time
+    // instead of walking every chain
+};
+
+// Default MyHashMap hasher: wyhash's 64-bit mix of the key with a seed. Each
+// instance draws its own seed, so keys chosen to collide (hash flooding) only
+// collide for a map whose seed the attacker knows, and no two maps share a
+// collision pattern. Pass an explicit seed for a reproducible layout.
+//
+// Integers and strings are supported. It is transparent: string, string_view
+// and const char* of the same text hash alike, which is what lets a map with
+// string keys be searched with a string_view without building a string.
+struct SeededHash {
+    using is_transparent = void;
+
+    static constexpr uint64_t P0 = 0xa0761d6478bd642fULL;
+    static constexpr uint64_t P1 = 0xe7037ed1a0b428dbULL;
+
+    uint64_t seed;
+
+    SeededHash() : seed(nextseed()) {}
+    explicit SeededHash(uint64_t s) : seed(s) {}
+
+    // random_device once per process, then a per-instance counter run through
+    // MurmurHash3's fmix64, which is far cheaper than a random_device read
+    static uint64_t nextseed() {
+        static const uint64_t base = [] {
+            random_device rd;
+            return ((uint64_t)rd() << 32) | rd();
+        }();
+        static atomic<uint64_t> counter{0};
+        uint64_t h = base + counter.fetch_add(1, memory_order_relaxed) * 0x9E3779B97F4A7C15ULL;
+        h ^= h >> 33;
+        h *= 0xff51afd7ed558ccdULL;
+        h ^= h >> 33;
+        h *= 0xc4ceb9fe1a85ec53ULL;
+        h ^= h >> 33;
+        return h;
+    }
+
+    static uint64_t mum(uint64_t a, uint64_t b) {
+        __uint128_t r = (__uint128_t)a * b;
+        return (uint64_t)r ^ (uint64_t)(r >> 64);
+    }
+
+    template <typename T, typename = enable_if_t<is_integral_v<T>>>
+    uint64_t operator()(T key) const {
+        __uint128_t r = (__uint128_t)((uint64_t)key ^ P0) * (seed ^ P1);
+        return mum((uint64_t)r ^ P0, (uint64_t)(r >> 64) ^ P1);
+    }
+
+    // Eight bytes per multiply, the tail zero-padded, the length folded in last
+    uint64_t operator()(string_view s) const {
+        uint64_t h = seed;
+        size_t n = s.size();
+        const char* p = s.data();
+        for (; n >= 8; n -= 8, p += 8) {
+            uint64_t w;
+            memcpy(&w, p, 8);
+            h = mum(h ^ w ^ P0, seed ^ P1);
         }
+        uint64_t w = 0;
+        memcpy(&w, p, n);
+        h = mum(h ^ w ^ P0, seed ^ P1);
+        return mum(h ^ P0, s.size() ^ P1);
     }
 };
 
-int main() {
-    MyHashMap map;
-    
-    // Test cases
-    cout << "Testing HashMap implementation:" << endl;
-    
-    // Test put and get
-    map.put(1, 1);
-    map.put(2, 2);
-    cout << "get(1): " << map.get(1) << endl;  // Should return 1
-    cout << "get(2): " << map.get(2) << endl;  // Should return 2
-    cout << "get(3): " << map.get(3) << endl;  // Should return -1
-    
-    // Test update
-    map.put(2, 1);
-    cout << "get(2) after update: " << map.get(2) << endl;  // Should return 1
-    
-    // Test remove
-    map.remove(2);
-    cout << "get(2) after remove: " << map.get(2) << endl;  // Should return -1
-    
-    // Test edge cases
-    map.put(0, 0);
-    cout << "get(0): " << map.get(0) << endl;  // Should return 0
-    
-    map.put(1000000, 1000000);
-    cout << "get(1000000): " << map.get(1000000) << endl;  // Should return 1000000
+// Bitmask of the 16 control bytes at ctrl (16-byte aligned) equal to b
+inline uint32_t ctrlmatch(const int8_t* ctrl, int8_t b) {
+#ifdef __SSE2__
+    __m128i bytes = _mm_load_si128((const __m128i*)ctrl);
+    return _mm_movemask_epi8(_mm_cmpeq_epi8(bytes, _mm_set1_epi8(b)));
+#else
+    uint32_t res = 0;
+    for (int i = 0; i < 16; i++) {
+        res |= (uint32_t)(ctrl[i] == b) << i;
+    }
+    return res;
+#endif
+}
+
+// Bitmask of the free (EMPTY or DELETED) control bytes at ctrl: the ones
+// with the sign bit clear
+inline uint32_t ctrlfree(const int8_t* ctrl) {
+#ifdef __SSE2__
+    return ~_mm_movemask_epi8(_mm_load_si128((const __m128i*)ctrl)) & 0xFFFF;
+#else
+    uint32_t res = 0;
+    for (int i = 0; i < 16; i++) {
+        res |= (uint32_t)(ctrl[i] >= 0) << i;
+    }
+    return res;
+#endif
+}
+
+// Which value MyHashMap::build_from keeps for a key given more than once
+enum class Duplicates { lastwins, firstwins };
+
+// How MyHashMap lays out the 16 entries of a group: each key next to its
+// value, or all 16 keys and then all 16 values
+enum class Layout { interleaved, split };
+
+// MyHashMap's layout unless one is given: split only for trivially copyable
+// keys and values whose pair would be padded, where it saves memory. With no
+// padding to remove (int to int), split would only put a hit's value on a
+// different cache line from its key.
+template <typename K, typename V>
+constexpr Layout defaultlayout = is_trivially_copyable_v<K> && is_trivially_copyable_v<V> &&
+                                         sizeof(pair<K, V>) > sizeof(K) + sizeof(V)
+                                     ? Layout::split
+                                     : Layout::interleaved;
+
+// Open-addressing hash map in the Swiss-table style. Slots come in groups of
+// 16, each with a control byte that is EMPTY, DELETED, or 0x80 | the low 7
+// bits of the key's hash (its tag) when full, so the sign bit alone tells full
+// from free. A lookup hashes once, picks a home group from the remaining bits
+// and compares the tag against all 16 control bytes of the group with one
+// SSE2 compare, touching key slots only on a tag match. Keys and values sit
+// inline right after their control bytes, so a typical lookup touches one
+// group and no pointers.
+//
+// In the split layout a group's keys are packed together ahead of its
+// values, so probing reads only the control bytes and the keys, and padded
+// entries lose their padding (uint64_t to uint32_t takes 12 bytes a slot
+// rather than 16). It needs trivially copyable K and V and is the default
+// only where it removes padding (see defaultlayout): for unpadded entries it
+// saves nothing and costs a hit a second cache line. Everything else keeps
+// each key beside its value.
+//
+// The table doubles once 7/8 of its slots are used (DELETED slots count as
+// used) and halves once fewer than 1/8 hold keys. Rehashing is incremental:
+// the old table is kept alongside the new one and every put and remove moves
+// MIGRATESTEP of its groups across, so no single call pays for the whole
+// table. Lookups check both tables until the move is done. The drained table's
+// pages are then handed back to the OS RELEASESTEP bytes per call as well.
+//
+// Entries are constructed in place in their slot and moved, never copied,
+// when a rehash relocates them; any put or remove may therefore relocate
+// entries, invalidating pointers returned by find and all iterators.
+//
+// Hash maps a key to a uint64_t and must mix every input bit into every
+// output bit: the low 7 bits become the tag and the bits above them pick the
+// group, so an identity hash piles strided keys into a few groups. When both
+// Hash and Eq declare is_transparent, find, contains and remove accept any
+// type they can hash and compare against K (string_view for string keys).
+template <typename K = int, typename V = int, typename Hash = SeededHash, typename Eq = equal_to<>,
+          Layout L = defaultlayout<K, V>>
+class MyHashMap {
+private:
+    static constexpr int8_t EMPTY = 0;
+    static constexpr int8_t DELETED = 1;
+    static constexpr int GROUP = 16;
+    static constexpr size_t MIGRATESTEP = 1;
+    static constexpr size_t RELEASESTEP = 256 << 10;
+
+    template <typename T, typename = void>
+    struct transparent : false_type {};
+    template <typename T>
+    struct transparent<T, void_t<typename T::is_transparent>> : true_type {};
+
+    // Lookups take any Q for transparent Hash and Eq, K otherwise
+    template <typename Q>
+    using enableifkey = enable_if_t<transparent<Hash>::value && transparent<Eq>::value && !is_same_v<decay_t<Q>, K>>;
+
+    struct Slot {
+        K key;
+        V value;
+
+        template <typename KK, typename... Args>
+        Slot(piecewise_construct_t, KK&& k, Args&&... args) : key(forward<KK>(k)), value(forward<Args>(args)...) {}
+    };
+
+    // Slots are raw storage: only the ones whose control byte is full hold a
+    // live entry
+    struct alignas(16) InterleavedGroup {
+        int8_t ctrl[GROUP];
+        alignas(Slot) unsigned char raw[GROUP][sizeof(Slot)];
+
+        Slot& slot(int i) {
+            return *launder(reinterpret_cast<Slot*>(raw[i]));
+        }
+
+        const Slot& slot(int i) const {
+            return *launder(reinterpret_cast<const Slot*>(raw[i]));
+        }
+
+        K& key(int i) {
+            return slot(i).key;
+        }
+
+        const K& key(int i) const {
+            return slot(i).key;
+        }
+
+        V& value(int i) {
+            return slot(i).value;
+        }
+
+        const V& value(int i) const {
+            return slot(i).value;
+        }
+
+        template <typename KK, typename... Args>
+        void construct(int i, KK&& k, Args&&... args) {
+            new (raw[i]) Slot(piecewise_construct, forward<KK>(k), forward<Args>(args)...);
+        }
+
+        void destroy(int i) {
+            slot(i).~Slot();
+        }
+    };
+
+    struct alignas(16) SplitGroup {
+        int8_t ctrl[GROUP];
+        alignas(K) unsigned char keys[GROUP][sizeof(K)];
+        alignas(V) unsigned char values[GROUP][sizeof(V)];
+
+        K& key(int i) {
+            return *launder(reinterpret_cast<K*>(keys[i]));
+        }
+
+        const K& key(int i) const {
+            return *launder(reinterpret_cast<const K*>(keys[i]));
+        }
+
+        V& value(int i) {
+            return *launder(reinterpret_cast<V*>(values[i]));
+        }
+
+        const V& value(int i) const {
+            return *launder(reinterpret_cast<const V*>(values[i]));
+        }
+
+        // Trivially copyable types are trivially destructible, so a throwing
+        // V constructor leaves nothing to undo
+        template <typename KK, typename... Args>
+        void construct(int i, KK&& k, Args&&... args) {
+            new (keys[i]) K(forward<KK>(k));
+            new (values[i]) V(forward<Args>(args)...);
+        }
+
+        void destroy(int) {}
+    };
+
+    static_assert(L == Layout::interleaved || (is_trivially_copyable_v<K> && is_trivially_copyable_v<V>),
+                  "the split layout needs trivially copyable keys and values");
+    using Group = conditional_t<L == Layout::split, SplitGroup, InterleavedGroup>;
+    static_assert(alignof(Group) <= alignof(max_align_t), "calloc cannot align this key or value type");
+
+    // One open-addressed table. The memory comes from calloc, so a new table
+    // is all EMPTY without being written: large blocks are fresh zero pages
+    // that fault in as inserts reach them, rather than a memset over the whole
+    // table inside the put that triggered the resize.
+    struct Table {
+        Group* groups = nullptr;  // power-of-two count
+        size_t mask = 0;          // group count - 1
+        size_t count = 0;
+        size_t growthleft = 0;    // EMPTY slots that may still be filled
+
+        Table() {}
+
+        explicit Table(size_t n) : groups((Group*)calloc(n, sizeof(Group))), mask(n - 1), growthleft(n * GROUP * 7 / 8) {
+            if (groups == nullptr) {
+                throw bad_alloc();
+            }
+        }
+
+        Table(const Table&) = delete;
+        Table& operator=(const Table&) = delete;
+
+        void swap(Table& other) {
+            std::swap(groups, other.groups);
+            std::swap(mask, other.mask);
+            std::swap(count, other.count);
+            std::swap(growthleft, other.growthleft);
+        }
+
+        size_t size() const {
+            return groups == nullptr ? 0 : mask + 1;
+        }
+
+        // Skips the walk for an empty table, which also keeps a retired
+        // table's released pages from being faulted back in
+        ~Table() {
+            if (!is_trivially_destructible_v<Slot> && count > 0) {
+                for (size_t g = 0; g <= mask; g++) {
+                    for (int i = 0; i < GROUP; i++) {
+                        if (groups[g].ctrl[i] < 0) {
+                            groups[g].destroy(i);
+                        }
+                    }
+                }
+            }
+            free(groups);
+        }
+    };
+
+    Table cur;
+    Table old;              // table being drained by a rehash, empty otherwise
+    size_t migrated = 0;    // groups of old already moved into cur
+    Table retired;          // drained table whose pages are being released
+    size_t released = 0;    // bytes of retired already released
+    Hash hasher;
+    Eq eq;
+
+    METRICS(mutable HashMapStats counters;)
+
+    static uint32_t match(const Group& g, int8_t b) {
+        return ctrlmatch(g.ctrl, b);
+    }
+
+    static uint32_t matchfree(const Group& g) {
+        return ctrlfree(g.ctrl);
+    }
+
+    template <typename Q>
+    uint64_t hash(const Q& key) const {
+        return hasher(key);
+    }
+
+    static int8_t tagof(uint64_t h) {
+        return (int8_t)(0x80 | (h & 0x7F));
+    }
+
+    // Smallest group count that holds n keys below the 7/8 growth threshold
+    static size_t groupsfor(size_t n) {
+        size_t g = 1;
+        while (g * GROUP * 7 / 8 < n) {
+            g <<= 1;
+        }
+        return g;
+    }
+
+    // Locates key in t; returns false if it is absent. Groups are probed
+    // triangularly (home, +1, +3, +6, ...), which visits every group once
+    // when the group count is a power of two.
+    template <typename Q>
+    bool find(const Table& t, const Q& key, uint64_t h, size_t& g, int& i) const {
+        int8_t tag = tagof(h);
+        g = (h >> 7) & t.mask;
+        for (size_t step = 0;; g = (g + ++step) & t.mask) {
+            const Group& grp = t.groups[g];
+            for (uint32_t m = match(grp, tag); m != 0; m &= m - 1) {
+                i = __builtin_ctz(m);
+                if (eq(grp.key(i), key)) {
+                    METRICS(counters.probelength.record(step + 1);)
+                    return true;
+                }
+            }
+            // The probe for any key stops at the first group with an EMPTY slot
+            if (match(grp, EMPTY) != 0) {
+                METRICS(counters.probelength.record(step + 1);)
+                return false;
+            }
+        }
+    }
+
+    // The table holding key, cur or (mid-rehash) old, or nullptr. Not const
+    // itself so that the mutating members can use the result.
+    template <typename Q>
+    Table* locate(const Q& key, uint64_t h, size_t& g, int& i) const {
+        if (find(cur, key, h, g, i)) {
+            return const_cast<Table*>(&cur);
+        }
+        if (old.groups != nullptr && find(old, key, h, g, i)) {
+            return const_cast<Table*>(&old);
+        }
+        return nullptr;
+    }
+
+    // Constructs an entry for a key known to be absent in the first free slot
+    // on its probe path. The control byte is only set once construction has
+    // succeeded, so a throwing constructor leaves the table unchanged.
+    template <typename KK, typename... Args>
+    static V& insertnew(Table& t, uint64_t h, KK&& key, Args&&... args) {
+        size_t g = (h >> 7) & t.mask;
+        for (size_t step = 0;; g = (g + ++step) & t.mask) {
+            Group& grp = t.groups[g];
+            uint32_t m = matchfree(grp);
+            if (m != 0) {
+                int i = __builtin_ctz(m);
+                grp.construct(i, forward<KK>(key), forward<Args>(args)...);
+                if (grp.ctrl[i] == EMPTY) {
+                    t.growthleft--;
+                }
+                grp.ctrl[i] = tagof(h);
+                t.count++;
+                return grp.value(i);
+            }
+        }
+    }
+
+    // A group that still has an EMPTY slot has never been full, so no probe
+    // ever ran past it and the slot can go straight back to EMPTY. Otherwise
+    // leave a tombstone so later groups stay reachable.
+    static void erase(Table& t, size_t g, int i) {
+        t.groups[g].destroy(i);
+        if (match(t.groups[g], EMPTY) != 0) {
+            t.groups[g].ctrl[i] = EMPTY;
+            t.growthleft++;
+        } else {
+            t.groups[g].ctrl[i] = DELETED;
+        }
+        t.count--;
+    }
+
+    // Moves up to n groups of the old table into cur, releasing it once it is
+    // empty. A moved group's control bytes become all EMPTY if it had an
+    // EMPTY slot and all DELETED otherwise, so probes in the old table stop
+    // at exactly the groups they stopped at before and the keys not yet moved
+    // stay reachable.
+    void migrate(size_t n) {
+        for (; n > 0 && migrated < old.size() && old.count > 0; n--, migrated++) {
+            Group& grp = old.groups[migrated];
+            int8_t fill = match(grp, EMPTY) != 0 ? EMPTY : DELETED;
+            for (int i = 0; i < GROUP; i++) {
+                if (grp.ctrl[i] < 0) {
+                    insertnew(cur, hash(grp.key(i)), std::move(grp.key(i)), std::move(grp.value(i)));
+                    grp.destroy(i);
+                    old.count--;
+                }
+            }
+            memset(grp.ctrl, fill, GROUP);
+        }
+        if (old.groups != nullptr && old.count == 0) {
+            Table().swap(retired);
+            old.swap(retired);
+            released = 0;
+        }
+    }
+
+    // Returns up to RELEASESTEP bytes of the retired table's pages to the OS,
+    // freeing it once they are all gone. Freeing a table of a few million
+    // slots in one go unmaps every page at once, a pause of milliseconds.
+    void release() {
+        if (retired.groups == nullptr) {
+            return;
+        }
+        uintptr_t page = sysconf(_SC_PAGESIZE);
+        uintptr_t lo = ((uintptr_t)retired.groups + page - 1) & ~(page - 1);
+        uintptr_t hi = ((uintptr_t)retired.groups + retired.size() * sizeof(Group)) & ~(page - 1);
+        uintptr_t start = lo + released;
+        uintptr_t end = min(start + RELEASESTEP, hi);
+        if (start < end) {
+            madvise((void*)start, end - start, MADV_DONTNEED);
+            released += end - start;
+        }
+        if (end >= hi) {
+            Table().swap(retired);
+        }
+    }
+
+    // Starts moving every key into a new table of newgroups groups, finishing
+    // any rehash still in flight first. Every table is sized so that its
+    // growthleft covers the keys still waiting in old, which is what lets
+    // migrate insert without checking.
+    void startrehash(size_t newgroups) {
+        migrate(SIZE_MAX);
+        Table next(newgroups);
+        old.swap(cur);
+        cur.swap(next);
+        migrated = 0;
+        migrate(MIGRATESTEP);
+    }
+
+    // Makes sure cur can take one more key on top of those still in old:
+    // grow, or just sweep out DELETED slots if the table is mostly tombstones
+    void makeroom() {
+        if (cur.growthleft <= old.count) {
+            migrate(SIZE_MAX);
+            if (cur.growthleft == 0) {
+                startrehash(size() * 2 >= capacity() * 7 / 8 ? cur.size() * 2 : cur.size());
+            }
+        }
+    }
+
+    // Shared by try_emplace and insert_or_assign: the value for key,
+    // constructed from args if key was absent, and whether it was
+    template <typename KK, typename... Args>
+    pair<V*, bool> emplace(KK&& key, Args&&... args) {
+        migrate(MIGRATESTEP);
+        release();
+        uint64_t h = hash(key);
+        size_t g;
+        int i;
+        if (Table* t = locate(key, h, g, i)) {
+            return {&t->groups[g].value(i), false};
+        }
+        makeroom();
+        V& v = insertnew(cur, h, forward<KK>(key), forward<Args>(args)...);
+        METRICS(counters.inserts++;)
+        return {&v, true};
+    }
+
+    template <typename Q>
+    V* lookup(const Q& key) const {
+        METRICS(SampledTimer timer(counters.getlatency);)
+        size_t g;
+        int i;
+        if (Table* t = locate(key, hash(key), g, i)) {
+            METRICS(counters.hits++;)
+            return &t->groups[g].value(i);
+        }
+        METRICS(counters.misses++;)
+        return nullptr;
+    }
+
+    template <typename Q>
+    bool eraseone(const Q& key) {
+        METRICS(SampledTimer timer(counters.removelatency);)
+        migrate(MIGRATESTEP);
+        release();
+        size_t g;
+        int i;
+        Table* t = locate(key, hash(key), g, i);
+        if (t == nullptr) {
+            return false;
+        }
+        erase(*t, g, i);
+        if (t == &old) {
+            migrate(0);  // releases old if that was its last key
+        }
+        METRICS(counters.removes++;)
+
+        // Shrink to a quarter full once under 1/8, leaving room to grow again
+        // before the next resize either way
+        if (!rehashing() && cur.size() > 1 && size() * 8 < capacity()) {
+            startrehash(groupsfor(size() * 2));
+        }
+        return true;
+    }
+
+public:
+    // Forward iterator over cur, then over what old still holds mid-rehash.
+    // Dereferencing yields pair<const K&, V&> by value, so bind entries with
+    // auto or auto&&: for (auto [key, value] : map).
+    template <bool isconst>
+    class basic_iterator {
+    private:
+        using Map = conditional_t<isconst, const MyHashMap, MyHashMap>;
+        friend class MyHashMap;
+        template <bool>
+        friend class basic_iterator;
+
+        Map* map = nullptr;
+        int table = 0;    // 0 for cur, 1 for old
+        size_t pos = 0;   // group * GROUP + slot
+
+        basic_iterator(Map* m, int t, size_t p) : map(m), table(t), pos(p) {
+            skipfree();
+        }
+
+        const Table& tbl() const {
+            return table == 0 ? map->cur : map->old;
+        }
+
+        void skipfree() {
+            for (;;) {
+                const Table& t = tbl();
+                while (pos < t.size() * GROUP && t.groups[pos / GROUP].ctrl[pos % GROUP] >= 0) {
+                    pos++;
+                }
+                if (pos < t.size() * GROUP || table == 1) {
+                    return;
+                }
+                table = 1;
+                pos = 0;
+            }
+        }
+
+    public:
+        using iterator_category = forward_iterator_tag;
+        using value_type = pair<const K, V>;
+        using difference_type = ptrdiff_t;
+        using reference = pair<const K&, conditional_t<isconst, const V&, V&>>;
+
+        struct pointer {
+            reference ref;
+            reference* operator->() {
+                return &ref;
+            }
+        };
+
+        basic_iterator() {}
+
+        // iterator converts to const_iterator
+        template <bool c, typename = enable_if_t<isconst && !c>>
+        basic_iterator(const basic_iterator<c>& other) : map(other.map), table(other.table), pos(other.pos) {}
+
+        reference operator*() const {
+            Group& grp = const_cast<Table&>(tbl()).groups[pos / GROUP];
+            return {grp.key(pos % GROUP), grp.value(pos % GROUP)};
+        }
+
+        pointer operator->() const {
+            return {**this};
+        }
+
+        basic_iterator& operator++() {
+            pos++;
+            skipfree();
+            return *this;
+        }
+
+        basic_iterator operator++(int) {
+            basic_iterator res = *this;
+            ++*this;
+            return res;
+        }
+
+        bool operator==(const basic_iterator& other) const {
+            return table == other.table && pos == other.pos;
+        }
+
+        bool operator!=(const basic_iterator& other) const {
+            return !(*this == other);
+        }
+    };
+
+    using iterator = basic_iterator<false>;
+    using const_iterator = basic_iterator<true>;
+
+    explicit MyHashMap(Hash h = Hash(), Eq e = Eq()) : cur(1), hasher(h), eq(e) {}
+
+    iterator begin() {
+        return iterator(this, 0, 0);
+    }
+
+    iterator end() {
+        return iterator(this, 1, old.size() * GROUP);
+    }
+
+    const_iterator begin() const {
+        return const_iterator(this, 0, 0);
+    }
+
+    const_iterator end() const {
+        return const_iterator(this, 1, old.size() * GROUP);
+    }
+
+    // Sizes the table so that n keys fit without a rehash. This one rehashes
+    // all at once rather than incrementally.
+    void reserve(size_t n) {
+        size_t g = groupsfor(n);
+        if (g > cur.size()) {
+            startrehash(g);
+            migrate(SIZE_MAX);
+        }
+    }
+
+    size_t size() const {
+        return cur.count + old.count;
+    }
+
+    size_t capacity() const {
+        return cur.size() * GROUP;
+    }
+
+    double loadfactor() const {
+        return (double)size() / capacity();
+    }
+
+    // Bytes of group storage held, counting the old table mid-rehash
+    size_t bytes() const {
+        return (cur.size() + old.size()) * sizeof(Group);
+    }
+
+    // True while a rehash is still moving keys out of the old table
+    bool rehashing() const {
+        return old.groups != nullptr;
+    }
+
+    // Replaces the map's contents with the n pairs at data, sized for n up
+    // front and filled on up to nthreads threads. Duplicate keys keep the
+    // last (lastwins, like a put loop) or the first (firstwins, like a
+    // try_emplace loop) of their values.
+    //
+    // The group array is cut into one contiguous region per thread and each
+    // key goes to the thread owning its home group, in input order, so the
+    // threads write disjoint groups and need no synchronisation. A key whose
+    // probe path leaves its region before finding its slot is deferred, and
+    // the deferred keys are placed serially at the end. All copies of a key
+    // share a probe path, so they are either all placed by their region's
+    // thread or all deferred, and their input order holds either way.
+    void build_from(const pair<K, V>* data, size_t n, Duplicates dup = Duplicates::lastwins,
+                    unsigned nthreads = thread::hardware_concurrency()) {
+        if (n > UINT32_MAX) {
+            throw length_error("build_from: too many pairs");
+        }
+        size_t ngroups = groupsfor(n);
+        Table fresh(ngroups);
+        cur.swap(fresh);
+        Table().swap(old);
+        Table().swap(retired);
+        migrated = 0;
+
+        size_t nregions = max<size_t>(1, min<size_t>(nthreads, ngroups / 64));
+        int groupbits = __builtin_ctzll(ngroups);
+        auto regionof = [&](size_t g) {
+            return (g * nregions) >> groupbits;
+        };
+        auto parallel = [&](auto f) {
+            vector<thread> workers;
+            for (size_t t = 1; t < nregions; t++) {
+                workers.emplace_back(f, t);
+            }
+            f(0);
+            for (auto& w : workers) {
+                w.join();
+            }
+        };
+
+        // Hash every key and count, per input chunk, the keys of each region
+        vector<uint64_t> hashes(n);
+        vector<vector<size_t>> counts(nregions, vector<size_t>(nregions));
+        parallel([&](size_t c) {
+            for (size_t i = n * c / nregions; i < n * (c + 1) / nregions; i++) {
+                hashes[i] = hash(data[i].first);
+                counts[c][regionof((hashes[i] >> 7) & cur.mask)]++;
+            }
+        });
+
+        // Stable scatter of input indices into region order (the identity
+        // for a single region, which skips it)
+        vector<size_t> regionstart(nregions + 1);
+        vector<vector<size_t>> offsets(nregions, vector<size_t>(nregions));
+        for (size_t r = 0, pos = 0; r < nregions; r++) {
+            regionstart[r] = pos;
+            for (size_t c = 0; c < nregions; c++) {
+                offsets[c][r] = pos;
+                pos += counts[c][r];
+            }
+        }
+        regionstart[nregions] = n;
+        vector<uint32_t> order(nregions > 1 ? n : 0);
+        if (nregions > 1) {
+            parallel([&](size_t c) {
+                for (size_t i = n * c / nregions; i < n * (c + 1) / nregions; i++) {
+                    order[offsets[c][regionof((hashes[i] >> 7) & cur.mask)]++] = i;
+                }
+            });
+        }
+        auto indexat = [&](size_t j) -> uint32_t {
+            return nregions > 1 ? order[j] : j;
+        };
+
+        // Fill each region, finding and inserting in one walk: with no
+        // DELETED slots yet, a group with a free slot ends the probe. The home
+        // group of the key PREFETCH places ahead is prefetched, every cache
+        // line of it since the walk reads the control bytes and then writes a
+        // slot further in, so that many misses are in flight at once.
+        const size_t PREFETCH = 16;
+        vector<size_t> inserted(nregions);
+        vector<vector<uint32_t>> deferred(nregions);
+        parallel([&](size_t r) {
+            for (size_t j = regionstart[r]; j < regionstart[r + 1]; j++) {
+                if (j + PREFETCH < regionstart[r + 1]) {
+                    const char* ahead = (const char*)&cur.groups[(hashes[indexat(j + PREFETCH)] >> 7) & cur.mask];
+                    for (size_t line = 0; line < sizeof(Group); line += 64) {
+                        __builtin_prefetch(ahead + line, 1);
+                    }
+                }
+                uint32_t idx = indexat(j);
+                uint64_t h = hashes[idx];
+                int8_t tag = tagof(h);
+                size_t g = (h >> 7) & cur.mask;
+                for (size_t step = 0;; g = (g + ++step) & cur.mask) {
+                    if (regionof(g) != r) {
+                        deferred[r].push_back(idx);
+                        break;
+                    }
+                    Group& grp = cur.groups[g];
+                    uint32_t m = match(grp, tag);
+                    for (; m != 0; m &= m - 1) {
+                        int i = __builtin_ctz(m);
+                        if (eq(grp.key(i), data[idx].first)) {
+                            if (dup == Duplicates::lastwins) {
+                                grp.value(i) = data[idx].second;
+                            }
+                            break;
+                        }
+                    }
+                    if (m != 0) {
+                        break;
+                    }
+                    uint32_t free = matchfree(grp);
+                    if (free != 0) {
+                        int i = __builtin_ctz(free);
+                        grp.construct(i, data[idx].first, data[idx].second);
+                        grp.ctrl[i] = tag;
+                        inserted[r]++;
+                        break;
+                    }
+                }
+            }
+        });
+        for (size_t r = 0; r < nregions; r++) {
+            cur.count += inserted[r];
+        }
+        cur.growthleft -= cur.count;
+
+        for (auto& keys : deferred) {
+            for (uint32_t idx : keys) {
+                size_t g;
+                int i;
+                if (find(cur, data[idx].first, hashes[idx], g, i)) {
+                    if (dup == Duplicates::lastwins) {
+                        cur.groups[g].value(i) = data[idx].second;
+                    }
+                } else {
+                    insertnew(cur, hashes[idx], data[idx].first, data[idx].second);
+                }
+            }
+        }
+        METRICS(counters.inserts += cur.count;)
+    }
+
+    void build_from(const vector<pair<K, V>>& pairs, Duplicates dup = Duplicates::lastwins,
+                    unsigned nthreads = thread::hardware_concurrency()) {
+        build_from(pairs.data(), pairs.size(), dup, nthreads);
+    }
+
+    // Pointer to key's value, or nullptr if it is absent
+    V* find(const K& key) {
+        return lookup(key);
+    }
+
+    const V* find(const K& key) const {
+        return lookup(key);
+    }
+
+    template <typename Q, typename = enableifkey<Q>>
+    V* find(const Q& key) {
+        return lookup(key);
+    }
+
+    template <typename Q, typename = enableifkey<Q>>
+    const V* find(const Q& key) const {
+        return lookup(key);
+    }
+
+    bool contains(const K& key) const {
+        return lookup(key) != nullptr;
+    }
+
+    template <typename Q, typename = enableifkey<Q>>
+    bool contains(const Q& key) const {
+        return lookup(key) != nullptr;
+    }
+
+    // Constructs V from args in place if key is absent, and otherwise leaves
+    // both the entry and args untouched (args are not moved from). Returns the
+    // value and whether it was inserted.
+    template <typename... Args>
+    pair<V*, bool> try_emplace(const K& key, Args&&... args) {
+        METRICS(SampledTimer timer(counters.putlatency);)
+        return emplace(key, forward<Args>(args)...);
+    }
+
+    template <typename... Args>
+    pair<V*, bool> try_emplace(K&& key, Args&&... args) {
+        METRICS(SampledTimer timer(counters.putlatency);)
+        return emplace(std::move(key), forward<Args>(args)...);
+    }
+
+    // Inserts key with value, or assigns value over the existing one
+    template <typename M>
+    pair<V*, bool> insert_or_assign(const K& key, M&& value) {
+        METRICS(SampledTimer timer(counters.putlatency);)
+        auto res = emplace(key, forward<M>(value));
+        if (!res.second) {
+            *res.first = forward<M>(value);
+            METRICS(counters.updates++;)
+        }
+        return res;
+    }
+
+    template <typename M>
+    pair<V*, bool> insert_or_assign(K&& key, M&& value) {
+        METRICS(SampledTimer timer(counters.putlatency);)
+        auto res = emplace(std::move(key), forward<M>(value));
+        if (!res.second) {
+            *res.first = forward<M>(value);
+            METRICS(counters.updates++;)
+        }
+        return res;
+    }
+
+    // The original int interface: put is insert_or_assign, get returns the
+    // value or -1 if the key is absent (use find where -1 is a legitimate
+    // value), remove erases and reports whether the key was there
+    void put(const K& key, const V& value) {
+        insert_or_assign(key, value);
+    }
+
+    V get(const K& key) const {
+        const V* v = lookup(key);
+        return v != nullptr ? *v : V(-1);
+    }
+
+    bool remove(const K& key) {
+        return eraseone(key);
+    }
+
+    template <typename Q, typename = enableifkey<Q>>
+    bool remove(const Q& key) {
+        return eraseone(key);
+    }
+
+    HashMapStats stats() const {
+        HashMapStats res;
+#ifdef ENABLE_METRICS
+        res = counters;
+#endif
+        res.size = size();
+        for (const Table* t : {&cur, &old}) {
+            for (size_t g = 0; g < t->size(); g++) {
+                for (int i = 0; i < GROUP; i++) {
+                    if (t->groups[g].ctrl[i] >= 0) {
+                        continue;
+                    }
+                    size_t pos = (hash(t->groups[g].key(i)) >> 7) & t->mask;
+                    size_t steps = 0;
+                    while (pos != g) {
+                        pos = (pos + ++steps) & t->mask;
+                    }
+                    if (steps >= res.displacements.size()) {
+                        res.displacements.resize(steps + 1);
+                    }
+                    res.displacements[steps]++;
+                }
+            }
+        }
+        return res;
+    }
+};
+
+// Header of a MappedHashMap file. The groups follow it, each 16 control bytes
+// (encoded as in MyHashMap) and then 16 (key, value) slots. The file holds
+// offsets and hashes only, no pointers, so it can be mapped at any address.
+struct MappedHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t keysize;
+    uint32_t valsize;
+    uint32_t groupsize;
+    uint64_t count;
+    uint64_t ngroups;
+    uint64_t seed;      // SeededHash seed the file was built with
+    uint64_t reserved[2];
+};
+
+// Read-only hash table that lives in a file. write() exports any map of
+// trivially copyable keys and values into MyHashMap's open-addressed layout;
+// open() maps the file and validates the header without reading anything
+// else, so a process is ready to query a table of any size in O(1) and the
+// pages are faulted in from the page cache on first lookup. Processes that
+// map the same file share those pages. Keys other than integers are hashed
+// and compared as raw bytes, so they must not contain padding.
+template <typename K = int, typename V = int>
+class MappedHashMap {
+private:
+    static_assert(is_trivially_copyable_v<K> && is_trivially_copyable_v<V>, "the file stores keys and values as raw bytes");
+
+    static constexpr int8_t EMPTY = 0;
+    static constexpr int GROUP = 16;
+
+    struct Slot {
+        K key;
+        V value;
+    };
+
+    struct alignas(16) Group {
+        int8_t ctrl[GROUP];
+        Slot slots[GROUP];
+    };
+
+    void* base = nullptr;
+    size_t length = 0;
+    const Group* groups = nullptr;
+    size_t mask = 0;
+    size_t count = 0;
+    SeededHash hasher{0};
+
+    // Integers go through SeededHash's integer mix, anything else as bytes
+    static uint64_t hashwith(const SeededHash& h, const K& key) {
+        if constexpr (is_integral_v<K>) {
+            return h(key);
+        } else {
+            return h(string_view((const char*)&key, sizeof(K)));
+        }
+    }
+
+public:
+    MappedHashMap() {}
+
+    MappedHashMap(const MappedHashMap&) = delete;
+    MappedHashMap& operator=(const MappedHashMap&) = delete;
+
+    ~MappedHashMap() {
+        close();
+    }
+
+    // Writes every (key, value) of map (anything with size() that iterates
+    // as pairs) to path, via a temporary file renamed into place so readers
+    // never see a partial table. The table is laid out in a file-backed
+    // mapping; the file starts as zeros, which is already all EMPTY.
+    template <typename Map>
+    static bool write(const char* path, const Map& map) {
+        size_t n = map.size();
+        size_t ngroups = 1;
+        while (ngroups * GROUP * 7 / 8 < n) {
+            ngroups <<= 1;
+        }
+        size_t bytes = sizeof(MappedHeader) + ngroups * sizeof(Group);
+
+        string tmp = string(path) + ".tmp";
+        int fd = ::open(tmp.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+        if (fd < 0) {
+            cerr << "Failed to create " << tmp << endl;
+            return false;
+        }
+        void* out = MAP_FAILED;
+        if (ftruncate(fd, bytes) == 0) {
+            out = mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        }
+        ::close(fd);
+        if (out == MAP_FAILED) {
+            cerr << "Failed to map " << tmp << endl;
+            remove(tmp.c_str());
+            return false;
+        }
+
+        SeededHash h;
+        MappedHeader hdr = {{'M', 'Y', 'H', 'M', 'A', 'P', '1', 0}, 1, sizeof(K), sizeof(V), sizeof(Group), n, ngroups,
+                            h.seed, {0, 0}};
+        memcpy(out, &hdr, sizeof(hdr));
+        Group* table = (Group*)((char*)out + sizeof(hdr));
+        for (auto [key, value] : map) {
+            uint64_t hv = hashwith(h, key);
+            size_t g = (hv >> 7) & (ngroups - 1);
+            for (size_t step = 0;; g = (g + ++step) & (ngroups - 1)) {
+                uint32_t m = ctrlfree(table[g].ctrl);
+                if (m != 0) {
+                    int i = __builtin_ctz(m);
+                    table[g].ctrl[i] = (int8_t)(0x80 | (hv & 0x7F));
+                    table[g].slots[i] = {key, value};
+                    break;
+                }
+            }
+        }
+
+        bool ok = munmap(out, bytes) == 0;
+        if (!ok || rename(tmp.c_str(), path) != 0) {
+            cerr << "Failed to write " << path << endl;
+            remove(tmp.c_str());
+            return false;
+        }
+        return true;
+    }
+
+    // Maps a file written by write(). Lookups fault pages in on demand.
+    // Readahead stays on (no MADV_RANDOM): it pulls in neighbouring groups no
+    // lookup asked for, but with one fault per 4K page instead, the first
+    // pass over a cold file was about 4x slower.
+    bool open(const char* path) {
+        close();
+        int fd = ::open(path, O_RDONLY);
+        if (fd < 0) {
+            cerr << "Failed to open " << path << endl;
+            return false;
+        }
+        struct stat st;
+        if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(MappedHeader)) {
+            cerr << "Failed to read " << path << endl;
+            ::close(fd);
+            return false;
+        }
+        void* p = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+        ::close(fd);
+        if (p == MAP_FAILED) {
+            cerr << "Failed to map " << path << endl;
+            return false;
+        }
+
+        MappedHeader hdr;
+        memcpy(&hdr, p, sizeof(hdr));
+        if (memcmp(hdr.magic, "MYHMAP1", 8) != 0 || hdr.version != 1 || hdr.keysize != sizeof(K) ||
+            hdr.valsize != sizeof(V) || hdr.groupsize != sizeof(Group) || hdr.ngroups == 0 ||
+            (hdr.ngroups & (hdr.ngroups - 1)) != 0 ||
+            hdr.ngroups > (st.st_size - sizeof(hdr)) / sizeof(Group)) {
+            cerr << path << " is not a table of this key/value type" << endl;
+            munmap(p, st.st_size);
+            return false;
+        }
+        base = p;
+        length = st.st_size;
+        groups = (const Group*)((const char*)p + sizeof(hdr));
+        mask = hdr.ngroups - 1;
+        count = hdr.count;
+        hasher = SeededHash(hdr.seed);
+        return true;
+    }
+
+    void close() {
+        if (base != nullptr) {
+            munmap(base, length);
+            base = nullptr;
+            groups = nullptr;
+            count = 0;
+        }
+    }
+
+    size_t size() const {
+        return count;
+    }
+
+    // Pointer into the mapping at key's value, or nullptr if it is absent
+    const V* find(const K& key) const {
+        if (groups == nullptr) {
+            return nullptr;
+        }
+        uint64_t h = hashwith(hasher, key);
+        int8_t tag = (int8_t)(0x80 | (h & 0x7F));
+        size_t g = (h >> 7) & mask;
+        for (size_t step = 0;; g = (g + ++step) & mask) {
+            const Group& grp = groups[g];
+            for (uint32_t m = ctrlmatch(grp.ctrl, tag); m != 0; m &= m - 1) {
+                int i = __builtin_ctz(m);
+                if (memcmp(&grp.slots[i].key, &key, sizeof(K)) == 0) {
+                    return &grp.slots[i].value;
+                }
+            }
+            if (ctrlmatch(grp.ctrl, EMPTY) != 0) {
+                return nullptr;
+            }
+        }
+    }
+};
+
+// Thread-safe chained hash map whose reads never block. Buckets are atomic
+// list heads; get walks a chain with acquire loads and takes no lock.
+// Writers lock one of NSTRIPES stripes (the top bits of the hash), publish
+// new nodes at the head of a chain with a release store, update values in
+// place with an atomic store and retire unlinked nodes to the EpochDomain, so
+// a reader already on a removed node can finish its walk safely.
+//
+// A stripe that holds more keys than its share of buckets starts a resize
+// into a bucket array twice the size. Buckets are picked by the top bits of
+// the hash too, so every stripe owns one contiguous run of buckets in any
+// array, and the move goes one stripe at a time, touching only that run's
+// pages: under the stripe's lock its nodes are copied into the new array,
+// the stripe's forwarding flag in the old array is set and the old nodes are
+// retired. A writer moves its own stripe before touching it, and one more
+// from a shared cursor, so no writer copies more than two stripes' worth of
+// nodes. Readers follow the flag to the new array; the new array becomes
+// the table once the last stripe has moved.
+//
+// Nodes come from a NodeArena per stripe. A key's stripe does not change
+// across resizes, so every node is created under its own stripe's lock, and
+// the whole map is freed a slab at a time rather than node by node.
+template <typename Hash = SeededHash>
+class ConcurrentHashMap {
+private:
+    static constexpr int STRIPEBITS = 8;
+    static constexpr size_t NSTRIPES = size_t(1) << STRIPEBITS;
+
+    struct Node {
+        int key;
+        atomic<int> value;
+        atomic<Node*> next;
+        Node(int k, int v, Node* n) : key(k), value(v), next(n) {}
+    };
+
+    // The heads come from calloc, as MyHashMap's tables do, so the writer
+    // that starts a resize does not also clear the whole new array: its
+    // zero pages fault in as stripes move into them.
+    struct Buckets {
+        int bits;           // log2 of the bucket count, at least STRIPEBITS
+        atomic<Node*>* heads;
+        // Resize state: the array being moved to, which stripes are there
+        // already, the next stripe for a helping writer and how many are done
+        atomic<Buckets*> next{nullptr};
+        atomic<bool> moved[NSTRIPES];
+        atomic<size_t> cursor{0};
+        atomic<size_t> done{0};
+        explicit Buckets(int b) : bits(b), heads((atomic<Node*>*)calloc(size_t(1) << b, sizeof(atomic<Node*>))) {
+            static_assert(atomic<Node*>::is_always_lock_free, "an all-zero atomic pointer must be null");
+            if (heads == nullptr) {
+                throw bad_alloc();
+            }
+            for (auto& m : moved) {
+                m.store(false, memory_order_relaxed);
+            }
+        }
+        Buckets(const Buckets&) = delete;
+        Buckets& operator=(const Buckets&) = delete;
+        ~Buckets() {
+            free(heads);
+        }
+
+        size_t bucket(uint64_t h) const {
+            return h >> (64 - bits);
+        }
+
+        // Stripe si owns buckets [si * perstripe(), (si + 1) * perstripe())
+        size_t perstripe() const {
+            return size_t(1) << (bits - STRIPEBITS);
+        }
+    };
+
+    // Node storage for one stripe. Writers allocate from the arena under
+    // the stripe lock. The epoch domain hands retired nodes back on whatever
+    // thread collects them, through a lock-free stack that the next
+    // allocation takes over whole. The map and every node still waiting in
+    // the domain hold a reference, so a pool outlives a map destroyed while
+    // some of its nodes are still retired.
+    struct Pool {
+        NodeArena<Node> arena;
+        atomic<Node*> returned{nullptr};
+        atomic<size_t> refs{1};
+    };
+
+    struct alignas(64) Stripe {
+        mutex lock;
+        size_t count = 0;
+        Pool* nodes = new Pool;
+    };
+
+    atomic<Buckets*> table;
+    Stripe stripes[NSTRIPES];
+    Hash hasher;
+
+    static void releasepool(Pool* pool) {
+        if (pool->refs.fetch_sub(1, memory_order_acq_rel) == 1) {
+            delete pool;
+        }
+    }
+
+    static void releasenode(void* p, void* arg) {
+        Node* n = (Node*)p;
+        Pool* pool = (Pool*)arg;
+        Node* head = pool->returned.load(memory_order_relaxed);
+        do {
+            n->next.store(head, memory_order_relaxed);
+        } while (!pool->returned.compare_exchange_weak(head, n, memory_order_release, memory_order_relaxed));
+        releasepool(pool);
+    }
+
+    static void deletebuckets(void* p, void*) {
+        delete (Buckets*)p;
+    }
+
+    // A node of stripe si. Caller holds the stripe lock.
+    Node* newnode(size_t si, int key, int value, Node* next) {
+        Pool* pool = stripes[si].nodes;
+        if (pool->returned.load(memory_order_relaxed) != nullptr) {
+            for (Node* n = pool->returned.exchange(nullptr, memory_order_acquire); n != nullptr;) {
+                Node* after = n->next.load(memory_order_relaxed);
+                pool->arena.destroy(n);
+                n = after;
+            }
+        }
+        return pool->arena.create(key, value, next);
+    }
+
+    void retirenode(size_t si, Node* n) {
+        Pool* pool = stripes[si].nodes;
+        pool->refs.fetch_add(1, memory_order_relaxed);
+        EpochDomain::global().retire(n, releasenode, pool);
+    }
+
+    static size_t stripeof(uint64_t h) {
+        return h >> (64 - STRIPEBITS);
+    }
+
+    // The array holding stripe si's buckets right now, following forwarding
+    // flags from t (which may be a table already resized away)
+    static Buckets* current(Buckets* t, size_t si) {
+        while (t->moved[si].load(memory_order_acquire)) {
+            t = t->next.load(memory_order_acquire);
+        }
+        return t;
+    }
+
+    // Copies stripe si of t into t->next and forwards it there. Caller holds
+    // the stripe lock and pins an epoch.
+    void migrate(Buckets* t, size_t si) {
+        Buckets* next = t->next.load(memory_order_relaxed);
+        size_t first = si * t->perstripe(), last = first + t->perstripe();
+        for (size_t b = first; b < last; b++) {
+            for (Node* n = t->heads[b].load(memory_order_relaxed); n != nullptr;
+                 n = n->next.load(memory_order_relaxed)) {
+                auto& head = next->heads[next->bucket(hasher(n->key))];
+                head.store(newnode(si, n->key, n->value.load(memory_order_relaxed), head.load(memory_order_relaxed)),
+                           memory_order_relaxed);
+            }
+        }
+        t->moved[si].store(true, memory_order_release);
+        for (size_t b = first; b < last; b++) {
+            for (Node* n = t->heads[b].load(memory_order_relaxed); n != nullptr;) {
+                Node* after = n->next.load(memory_order_relaxed);
+                retirenode(si, n);
+                n = after;
+            }
+        }
+        if (t->done.fetch_add(1) + 1 == NSTRIPES) {
+            table.store(next, memory_order_release);
+            EpochDomain::global().retire(t, deletebuckets);
+        }
+    }
+
+    // Locks stripe si and returns the array its buckets live in, moving
+    // the stripe first if a resize has not reached it yet
+    Buckets* lockstripe(size_t si) {
+        stripes[si].lock.lock();
+        Buckets* t = table.load(memory_order_acquire);
+        if (t->next.load(memory_order_acquire) == nullptr) {
+            return t;
+        }
+        if (!t->moved[si].load(memory_order_relaxed)) {
+            migrate(t, si);
+        }
+        return t->next.load(memory_order_relaxed);
+    }
+
+    // Starts a resize of t if full and none is under way, then moves one
+    // more stripe of whichever resize is running. Called by every writer
+    // once its own stripe is unlocked.
+    void grow(Buckets* t, bool full) {
+        if (full && t == table.load(memory_order_acquire)) {
+            Buckets* expected = nullptr;
+            Buckets* next = new Buckets(t->bits + 1);
+            if (!t->next.compare_exchange_strong(expected, next)) {
+                delete next;
+            }
+        }
+        t = table.load(memory_order_acquire);
+        if (t->next.load(memory_order_acquire) == nullptr) {
+            return;
+        }
+        size_t si = t->cursor.fetch_add(1);
+        if (si < NSTRIPES) {
+            lock_guard<mutex> lock(stripes[si].lock);
+            if (!t->moved[si].load(memory_order_relaxed)) {
+                migrate(t, si);
+            }
+        }
+    }
+
+public:
+    explicit ConcurrentHashMap(Hash h = Hash()) : table(new Buckets(STRIPEBITS)), hasher(h) {}
+
+    ConcurrentHashMap(const ConcurrentHashMap&) = delete;
+    ConcurrentHashMap& operator=(const ConcurrentHashMap&) = delete;
+
+    int get(int key) const {
+        EpochGuard guard;
+        uint64_t h = hasher(key);
+        Buckets* t = current(table.load(memory_order_acquire), stripeof(h));
+        for (Node* n = t->heads[t->bucket(h)].load(memory_order_acquire); n != nullptr;
+             n = n->next.load(memory_order_acquire)) {
+            if (n->key == key) {
+                return n->value.load(memory_order_relaxed);
+            }
+        }
+        return -1;  // Key not found
+    }
+
+    void put(int key, int value) {
+        EpochGuard guard;
+        uint64_t h = hasher(key);
+        Stripe& s = stripes[stripeof(h)];
+        Buckets* t = lockstripe(stripeof(h));
+        auto& head = t->heads[t->bucket(h)];
+        for (Node* n = head.load(memory_order_relaxed); n != nullptr; n = n->next.load(memory_order_relaxed)) {
+            if (n->key == key) {
+                n->value.store(value, memory_order_relaxed);
+                s.lock.unlock();
+                grow(t, false);
+                return;
+            }
+        }
+        head.store(newnode(stripeof(h), key, value, head.load(memory_order_relaxed)), memory_order_release);
+        bool full = ++s.count > t->perstripe();
+        s.lock.unlock();
+        grow(t, full);
+    }
+
+    void remove(int key) {
+        EpochGuard guard;
+        uint64_t h = hasher(key);
+        Stripe& s = stripes[stripeof(h)];
+        Buckets* t = lockstripe(stripeof(h));
+        atomic<Node*>* link = &t->heads[t->bucket(h)];
+        for (Node* n = link->load(memory_order_relaxed); n != nullptr; n = link->load(memory_order_relaxed)) {
+            if (n->key == key) {
+                link->store(n->next.load(memory_order_relaxed), memory_order_release);
+                s.count--;
+                s.lock.unlock();
+                retirenode(stripeof(h), n);
+                grow(t, false);
+                return;
+            }
+            link = &n->next;
+        }
+        s.lock.unlock();
+        grow(t, false);
+    }
+
+    // Exact when no writer is running, approximate otherwise
+    size_t size() {
+        size_t total = 0;
+        for (auto& s : stripes) {
+            lock_guard<mutex> lock(s.lock);
+            total += s.count;
+        }
+        return total;
+    }
+
+    // Live nodes go with their stripes' arenas, a slab at a time
+    ~ConcurrentHashMap() {
+        Buckets* t = table.load();
+        delete t->next.load();
+        delete t;
+        for (auto& s : stripes) {
+            releasepool(s.nodes);
+        }
+    }
+};
+
+void printstats(const HashMapStats& st) {
+    cout << st.size << " entries; displacement (probe steps: keys):";
+    for (size_t len = 0; len < st.displacements.size(); len++) {
+        if (st.displacements[len]) {
+            cout << " " << len << ":" << st.displacements[len];
+        }
+    }
+    cout << endl;
+    if (!st.enabled) {
+        cout << "counters are compiled out; rebuild with -DENABLE_METRICS" << endl;
+        return;
+    }
+    cout << "gets " << st.hits + st.misses << " (" << st.misses << " missed), inserts " << st.inserts
+         << ", updates " << st.updates << ", removes " << st.removes << endl;
+    cout << "probe length: p50 " << st.probelength.percentile(50) << ", p99 " << st.probelength.percentile(99)
+         << ", max " << st.probelength.maxvalue << endl;
+    for (auto op : {make_pair("get", &st.getlatency), make_pair("put", &st.putlatency),
+                    make_pair("remove", &st.removelatency)}) {
+        cout << op.first << " latency ns (sampled " << op.second->total << "): p50 " << op.second->percentile(50)
+             << ", p99 " << op.second->percentile(99) << ", p99.9 " << op.second->percentile(99.9) << endl;
+    }
+}
+
+// std::unordered_map behind the put/get interface, for the benchmarks
+struct StdHashMap {
+    unordered_map<int, int> m;
+
+    void put(int key, int value) {
+        m[key] = value;
+    }
+
+    int get(int key) const {
+        auto it = m.find(key);
+        return it == m.end() ? -1 : it->second;
+    }
+
+    void remove(int key) {
+        m.erase(key);
+    }
+};
+
+// MyHashMap behind one global mutex, the baseline ConcurrentHashMap replaces
+struct LockedHashMap {
+    MyHashMap<> m;
+    mutex lock;
+
+    void put(int key, int value) {
+        lock_guard<mutex> guard(lock);
+        m.put(key, value);
+    }
+
+    int get(int key) {
+        lock_guard<mutex> guard(lock);
+        return m.get(key);
+    }
+
+    void remove(int key) {
+        lock_guard<mutex> guard(lock);
+        m.remove(key);
+    }
+};
+
+// Benchmarks fold lookup results into this so the loops cannot be optimised away
+volatile long long benchsink;
+
+double nsperop(chrono::steady_clock::time_point start, size_t ops) {
+    return chrono::duration<double, nano>(chrono::steady_clock::now() - start).count() / ops;
+}
+
+// Times inserting keys, then looking up every key (hits) and as many absent
+// keys (misses), and prints one row of ns/op figures under the label row
+template <typename Map>
+void benchmap(const string& row, const char* name, Map& map, const vector<int>& keys, const vector<int>& absent) {
+    auto start = chrono::steady_clock::now();
+    for (int k : keys) {
+        map.put(k, k);
+    }
+    double insert = nsperop(start, keys.size());
+
+    long long sum = 0;
+    start = chrono::steady_clock::now();
+    for (int k : keys) {
+        sum += map.get(k);
+    }
+    double hit = nsperop(start, keys.size());
+
+    start = chrono::steady_clock::now();
+    for (int k : absent) {
+        sum += map.get(k);
+    }
+    double miss = nsperop(start, absent.size());
+    benchsink = sum;
+
+    cout << fixed << setprecision(1) << row << "\t" << name << "\t" << insert << "\t" << hit << "\t" << miss << endl;
+}
+
+// Open addressing vs the old chaining vs std::unordered_map at the load
+// factors the Swiss table runs at: n = load * 2^20 keys, with the Swiss
+// table reserved to exactly 2^20 slots
+void benchloadfactors() {
+    const size_t slots = 1 << 20;
+    cout << "load\tmap\tinsert\thit\tmiss (ns/op)" << endl;
+    for (string row : {"0.500", "0.625", "0.750", "0.875"}) {
+        size_t n = stod(row) * slots;
+        mt19937 rng(1);
+        vector<int> all(2 * n);
+        unordered_set<int> seen;
+        for (auto& k : all) {
+            do {
+                k = rng() & 0x7fffffff;
+            } while (!seen.insert(k).second);
+        }
+        vector<int> keys(all.begin(), all.begin() + n);
+        vector<int> absent(all.begin() + n, all.end());
+
+        MyHashMap swiss;
+        swiss.reserve(n);
+        benchmap(row, "swiss", swiss, keys, absent);
+        StdHashMap stdmap;
+        stdmap.m.reserve(n);
+        benchmap(row, "std", stdmap, keys, absent);
+        ChainedHashMap chained;
+        benchmap(row, "chained", chained, keys, absent);
+    }
+}
+
+// Counts the bytes a node-based map holds through it. malloc's own per-block
+// overhead is not included, so these figures are a lower bound.
+class CountingResource : public pmr::memory_resource {
+public:
+    size_t bytes = 0;
+
+private:
+    void* do_allocate(size_t n, size_t align) override {
+        bytes += n;
+        return pmr::new_delete_resource()->allocate(n, align);
+    }
+
+    void do_deallocate(void* p, size_t n, size_t align) override {
+        bytes -= n;
+        pmr::new_delete_resource()->deallocate(p, n, align);
+    }
+
+    bool do_is_equal(const pmr::memory_resource& other) const noexcept override {
+        return this == &other;
+    }
+};
+
+// A value wide enough that a group of them spans many cache lines
+struct WideValue {
+    uint64_t w[7];
+
+    WideValue(uint64_t v = 0) : w{v} {}
+};
+
+long long touch(uint64_t v) {
+    return v;
+}
+
+long long touch(const WideValue& v) {
+    return v.w[0];
+}
+
+// Times find(k) over keys, where find returns 0 for a miss
+template <typename Key, typename Find>
+double timelookups(const vector<Key>& keys, Find find) {
+    long long sum = 0;
+    auto start = chrono::steady_clock::now();
+    for (const Key& k : keys) {
+        sum += find(k);
+    }
+    double ns = nsperop(start, keys.size());
+    benchsink = sum;
+    return ns;
+}
+
+// Puts n random keys into each layout of MyHashMap<K, V> and prints bytes
+// per entry and hit/miss lookup cost, plus node-based baselines for int to
+// int.
+template <typename K, typename V>
+void benchlayoutrows(const char* entry, size_t n) {
+    mt19937_64 rng(9);
+    vector<K> keys(n), absent(n);
+    unordered_set<K> seen;
+    for (auto* v : {&keys, &absent}) {
+        for (auto& k : *v) {
+            do {
+                k = (K)(rng() & 0x7fffffff);
+            } while (!seen.insert(k).second);
+        }
+    }
+    auto row = [&](const char* name, double bytes, auto find) {
+        double hit = timelookups(keys, find);
+        double miss = timelookups(absent, find);
+        cout << fixed << setprecision(1) << entry << "\t" << name << "\t" << bytes / n << "\t" << hit << "\t"
+             << miss << endl;
+    };
+
+    if constexpr (is_same_v<K, int> && is_same_v<V, int>) {
+        CountingResource counted;
+        {
+            pmr::unordered_map<int, int> stdmap(&counted);
+            for (int k : keys) {
+                stdmap[k] = k;
+            }
+            row("std", counted.bytes + sizeof(stdmap), [&](int k) {
+                auto it = stdmap.find(k);
+                return it == stdmap.end() ? 0LL : it->second;
+            });
+        }
+    }
+
+    MyHashMap<K, V, SeededHash, equal_to<>, Layout::interleaved> interleaved;
+    for (const K& k : keys) {
+        interleaved.put(k, V(k));
+    }
+    row("interleaved", interleaved.bytes(), [&](const K& k) {
+        const V* v = interleaved.find(k);
+        return v ? touch(*v) : 0LL;
+    });
+
+    MyHashMap<K, V, SeededHash, equal_to<>, Layout::split> split;
+    for (const K& k : keys) {
+        split.put(k, V(k));
+    }
+    row("split", split.bytes(), [&](const K& k) {
+        const V* v = split.find(k);
+        return v ? touch(*v) : 0LL;
+    });
+}
+
+// Memory footprint and lookup cost of the group layouts, against node-based
+// maps, for small, padded and wide entries
+void benchlayout(size_t n) {
+    cout << n << " keys" << endl;
+    cout << "entry\tlayout\tbytes/entry\thit\tmiss (ns/op)" << endl;
+    benchlayoutrows<int, int>("int->int", n);
+    benchlayoutrows<uint64_t, uint32_t>("u64->u32", n);
+    benchlayoutrows<int, WideValue>("int->56B", n);
+}
+
+// The previous MyHashMap hash: MurmurHash3's fmix64, well mixed but unseeded
+struct Fmix64Hash {
+    uint64_t operator()(int key) const {
+        uint64_t h = (uint32_t)key;
+        h ^= h >> 33;
+        h *= 0xff51afd7ed558ccdULL;
+        h ^= h >> 33;
+        h *= 0xc4ceb9fe1a85ec53ULL;
+        h ^= h >> 33;
+        return h;
+    }
+};
+
+// No mixing at all, what std::hash<int> does
+struct IdentityHash {
+    uint64_t operator()(int key) const {
+        return (uint32_t)key;
+    }
+};
+
+// Hashers against key patterns: n sequential ids, ids strided by the old
+// bucket count (10007) and by a power of two (4096), and random keys across
+// the whole int range, negatives included. The misses are the next n keys of
+// the same pattern.
+void benchdistributions() {
+    const int n = 1 << 18;
+    mt19937 rng(1);
+    vector<pair<string, function<int(int)>>> patterns = {
+        {"sequential", [](int i) { return i; }},
+        {"stride10007", [](int i) { return i * 10007; }},
+        {"stride4096", [](int i) { return i * 4096; }},
+        {"random", [&](int) { return (int)rng(); }},
+    };
+    cout << "keys\thash\tinsert\thit\tmiss (ns/op)" << endl;
+    for (auto& pattern : patterns) {
+        vector<int> all;
+        unordered_set<int> seen;
+        for (int i = 0; (int)all.size() < 2 * n; i++) {
+            int k = pattern.second(i);
+            if (seen.insert(k).second) {
+                all.push_back(k);
+            }
+        }
+        vector<int> keys(all.begin(), all.begin() + n);
+        vector<int> absent(all.begin() + n, all.end());
+
+        MyHashMap<> seeded;
+        benchmap(pattern.first, "seeded", seeded, keys, absent);
+        MyHashMap<int, int, Fmix64Hash> fmix;
+        benchmap(pattern.first, "fmix64", fmix, keys, absent);
+        MyHashMap<int, int, IdentityHash> identity;
+        benchmap(pattern.first, "identity", identity, keys, absent);
+    }
+}
+
+// Per-call latency while a map grows from empty to n keys and then shrinks
+// back, timing every call so that resize pauses show up in the tail instead of
+// being averaged away. std::unordered_map rehashes all at once on growth and
+// never shrinks.
+template <typename Map>
+void benchgrowthrow(const char* name, Map& map, const vector<int>& keys) {
+    LatencyHistogram puts, removes;
+    for (int k : keys) {
+        auto start = chrono::steady_clock::now();
+        map.put(k, k);
+        puts.record(chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - start).count());
+    }
+    for (int k : keys) {
+        auto start = chrono::steady_clock::now();
+        map.remove(k);
+        removes.record(chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - start).count());
+    }
+    for (auto op : {make_pair("put", &puts), make_pair("remove", &removes)}) {
+        cout << name << "\t" << op.first << "\t" << op.second->percentile(50) << "\t" << op.second->percentile(99)
+             << "\t" << op.second->percentile(99.9) << "\t" << op.second->maxvalue << endl;
+    }
+}
+
+void benchgrowth(size_t n) {
+    mt19937 rng(1);
+    vector<int> keys(n);
+    for (auto& k : keys) {
+        k = rng() & 0x7fffffff;
+    }
+    cout << n << " keys, latency ns" << endl;
+    cout << "map\top\tp50\tp99\tp99.9\tmax" << endl;
+    MyHashMap swiss;
+    benchgrowthrow("swiss", swiss, keys);
+    StdHashMap stdmap;
+    benchgrowthrow("std", stdmap, keys);
+}
+
+// nthreads workers each running opsperthread random operations, 90% get,
+// 8% put and 2% remove, over keyrange keys; returns Mops/s
+template <typename Map>
+double runmix(Map& map, int nthreads, int keyrange, int opsperthread) {
+    vector<thread> workers;
+    atomic<long long> checksum{0};
+    auto start = chrono::steady_clock::now();
+    for (int t = 0; t < nthreads; t++) {
+        workers.emplace_back([&, t]() {
+            mt19937 rng(t + 1);
+            uniform_int_distribution<int> keys(0, keyrange - 1);
+            long long sum = 0;
+            for (int i = 0; i < opsperthread; i++) {
+                int k = keys(rng);
+                int op = i % 50;
+                if (op < 4) {
+                    map.put(k, i);
+                } else if (op == 4) {
+                    map.remove(k);
+                } else {
+                    sum += map.get(k);
+                }
+            }
+            checksum += sum;
+        });
+    }
+    for (auto& w : workers) {
+        w.join();
+    }
+    benchsink = checksum;
+    double secs = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    return (double)nthreads * opsperthread / secs / 1e6;
+}
+
+// Read-mostly scaling from 1 to 64 threads. Each run starts from a map
+// holding half the key range; puts outnumber removes, so the concurrent map
+// also resizes while the workers run.
+void benchconcurrent() {
+    const int keyrange = 1 << 21;
+    const int opsperthread = 200000;
+    cout << "threads\tlocked\tconcurrent\t(Mops/s)" << endl;
+    for (int nthreads = 1; nthreads <= 64; nthreads *= 2) {
+        LockedHashMap locked;
+        ConcurrentHashMap<> concurrent;
+        for (int k = 0; k < keyrange; k += 2) {
+            locked.put(k, k);
+            concurrent.put(k, k);
+        }
+        cout << nthreads << fixed << setprecision(2) << "\t" << runmix(locked, nthreads, keyrange, opsperthread);
+        cout << "\t" << runmix(concurrent, nthreads, keyrange, opsperthread) << endl;
+    }
+}
+
+// Insert/remove churn and teardown. Churn keeps n live keys and replaces a
+// random one per step (one remove plus one put), so every step frees a node
+// and allocates one. Teardown times the destructor of a map holding n keys.
+// Worst put is the slowest single put while the n keys are loaded, which is
+// where resizes stall a writer.
+template <typename Map>
+void benchchurnrow(const char* name, function<Map*()> make, int n) {
+    mt19937 rng(3);
+    vector<int> live(n);
+    Map* map = make();
+    double worst = 0;
+    for (int i = 0; i < n; i++) {
+        live[i] = i;
+        auto start = chrono::steady_clock::now();
+        map->put(i, i);
+        worst = max(worst, chrono::duration<double, micro>(chrono::steady_clock::now() - start).count());
+    }
+    const int steps = 2000000;
+    auto start = chrono::steady_clock::now();
+    for (int i = 0; i < steps; i++) {
+        int& k = live[rng() % n];
+        map->remove(k);
+        k = n + i;
+        map->put(k, i);
+    }
+    double churn = nsperop(start, steps);
+    start = chrono::steady_clock::now();
+    delete map;
+    double teardown = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+    cout << fixed << setprecision(1) << name << "\t" << churn << "\t" << teardown << "\t" << worst << endl;
+}
+
+void benchchurn() {
+    for (int n : {100000, 1000000}) {
+        cout << n << " keys" << endl;
+        cout << "map\tchurn ns/step\tteardown ms\tworst put us" << endl;
+        benchchurnrow<ChainedHashMap>("chained", [] { return new ChainedHashMap; }, n);
+        // The same map with its slabs drawn from a pmr pool resource
+        pmr::unsynchronized_pool_resource pool;
+        benchchurnrow<ChainedHashMap>("chained/pool", [&] { return new ChainedHashMap(&pool); }, n);
+        benchchurnrow<StdHashMap>("std", [] { return new StdHashMap; }, n);
+        benchchurnrow<ConcurrentHashMap<>>("concurrent", [] { return new ConcurrentHashMap<>; }, n);
+    }
+}
+
+// Loading n pairs (keys drawn from n values, so about a third are repeats)
+// with a put loop, a put loop after reserve, and build_from on 1 and on all
+// hardware threads. Rates are input pairs and input bytes per second.
+void benchbuild(size_t n) {
+    mt19937 rng(2);
+    vector<pair<int, int>> pairs(n);
+    for (auto& p : pairs) {
+        p = {(int)(rng() % n), (int)rng()};
+    }
+    auto row = [&](const string& name, function<void(MyHashMap<>&)> load) {
+        MyHashMap<> map;
+        auto start = chrono::steady_clock::now();
+        load(map);
+        double secs = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+        cout << fixed << setprecision(1) << name << "\t" << n / secs / 1e6 << "\t" << setprecision(2)
+             << n * sizeof(pairs[0]) / secs / 1e9 << "\t" << map.size() << endl;
+    };
+    unsigned hw = max(1u, thread::hardware_concurrency());
+    cout << n << " pairs" << endl;
+    cout << "load\tMpairs/s\tGB/s\tkeys" << endl;
+    row("put", [&](MyHashMap<>& map) {
+        for (auto& p : pairs) {
+            map.put(p.first, p.second);
+        }
+    });
+    row("reserve+put", [&](MyHashMap<>& map) {
+        map.reserve(n);
+        for (auto& p : pairs) {
+            map.put(p.first, p.second);
+        }
+    });
+    row("build/1", [&](MyHashMap<>& map) {
+        map.build_from(pairs, Duplicates::lastwins, 1);
+    });
+    row("build/" + to_string(hw), [&](MyHashMap<>& map) {
+        map.build_from(pairs, Duplicates::lastwins, hw);
+    });
+}
+
+// Drops path from the page cache, so that the next read comes from disk
+void evict(const char* path) {
+    int fd = open(path, O_RDONLY);
+    if (fd >= 0) {
+        fdatasync(fd);
+        posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+        close(fd);
+    }
+}
+
+// Cold start of a read-only table of n pairs: the current path reads a flat
+// file of pairs and puts them into a MyHashMap, the mapped path opens a
+// MappedHashMap file. Both files are evicted from the page cache first, and
+// each path is then timed to ready and through 1M lookups of stored keys;
+// the last row repeats the mapped path with the file already cached.
+void benchmapped(size_t n) {
+    const char* flat = "hashmap_pairs.bin";
+    const char* table = "hashmap_table.bin";
+    mt19937 rng(4);
+    vector<pair<int, int>> pairs(n);
+    for (auto& p : pairs) {
+        p = {(int)rng(), (int)rng()};
+    }
+    FILE* f = fopen(flat, "wb");
+    if (!f || fwrite(pairs.data(), sizeof(pairs[0]), n, f) != n || fclose(f) != 0) {
+        cerr << "Failed to write " << flat << endl;
+        return;
+    }
+    {
+        MyHashMap<> src;
+        src.build_from(pairs);
+        if (!MappedHashMap<>::write(table, src)) {
+            return;
+        }
+    }
+    vector<int> probes(1000000);
+    for (auto& k : probes) {
+        k = pairs[rng() % n].first;
+    }
+
+    cout << n << " pairs, 1M lookups" << endl;
+    cout << "path\tready ms\tlookups ms" << endl;
+    auto report = [&](const char* name, double ready, auto& map) {
+        long long sum = 0;
+        auto start = chrono::steady_clock::now();
+        for (int k : probes) {
+            sum += *map.find(k);
+        }
+        benchsink = sum;
+        double lookups = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+        cout << fixed << setprecision(1) << name << "\t" << ready << "\t" << lookups << endl;
+    };
+
+    evict(flat);
+    {
+        auto start = chrono::steady_clock::now();
+        vector<pair<int, int>> loaded(n);
+        FILE* in = fopen(flat, "rb");
+        size_t got = in ? fread(loaded.data(), sizeof(loaded[0]), n, in) : 0;
+        if (in) {
+            fclose(in);
+        }
+        MyHashMap<> map;
+        for (size_t i = 0; i < got; i++) {
+            map.put(loaded[i].first, loaded[i].second);
+        }
+        report("parse+put", chrono::duration<double, milli>(chrono::steady_clock::now() - start).count(), map);
+    }
+    for (bool cold : {true, false}) {
+        if (cold) {
+            evict(table);
+        }
+        auto start = chrono::steady_clock::now();
+        MappedHashMap<> map;
+        if (!map.open(table)) {
+            break;
+        }
+        report(cold ? "mmap" : "mmap/warm", chrono::duration<double, milli>(chrono::steady_clock::now() - start).count(),
+               map);
+    }
+    remove(flat);
+    remove(table);
+}
+
+// ./hashmap suite [ops-per-thread]: every workload in bench.h against a map
+// preloaded with the whole key space, as 90% get, 5% put, 5% remove; puts
+// count as hits. MyHashMap runs with one thread only, ConcurrentHashMap at
+// every thread count. Prints JSON.
+void suite(size_t opsperthread) {
+    vector<BenchResult> results;
+    for (uint32_t keyspace : {1u << 12, 1u << 16, 1u << 20}) {
+        for (Workload w : {Workload::uniform, Workload::zipf, Workload::scan}) {
+            auto single = makekeys(w, keyspace, 1, opsperthread);
+            MyHashMap<> map;
+            for (uint32_t k = 0; k < keyspace; k++) {
+                map.put(k, k);
+            }
+            results.push_back(runworkload("myhashmap", w, keyspace, single, [&](int, size_t i, uint32_t k) {
+                if (i % 20 == 0) {
+                    map.put(k, k);
+                } else if (i % 20 == 10) {
+                    return map.remove(k);
+                } else {
+                    return map.get(k) != -1;
+                }
+                return true;
+            }));
+
+            for (int nthreads : benchthreads()) {
+                auto streams = makekeys(w, keyspace, nthreads, opsperthread);
+                ConcurrentHashMap<> shared;
+                for (uint32_t k = 0; k < keyspace; k++) {
+                    shared.put(k, k);
+                }
+                results.push_back(runworkload("concurrent", w, keyspace, streams, [&](int, size_t i, uint32_t k) {
+                    if (i % 20 == 0) {
+                        shared.put(k, k);
+                    } else if (i % 20 == 10) {
+                        shared.remove(k);
+                    } else {
+                        return shared.get(k) != -1;
+                    }
+                    return true;
+                }));
+            }
+        }
+    }
+    printjson(cout, "hashmap", results);
+}
+
+// Random put/get/remove traffic followed by a stats() snapshot
+void demostats() {
+    MyHashMap map;
+    mt19937 rng(5);
+    uniform_int_distribution<int> keys(0, 199999);
+    for (int i = 0; i < 2000000; i++) {
+        int k = keys(rng);
+        switch (i % 4) {
+            case 0: map.put(k, i); break;
+            case 3: map.remove(k); break;
+            default: map.get(k); break;
+        }
+    }
+    printstats(map.stats());
+}
+
+int main(int argc, char** argv) {
+    if (argc > 1 && string(argv[1]) == "bench") {
+        benchloadfactors();
+        return 0;
+    }
+    if (argc > 1 && string(argv[1]) == "layout") {
+        benchlayout(argc > 2 ? stoul(argv[2]) : 1500000);
+        return 0;
+    }
+    if (argc > 1 && string(argv[1]) == "build") {
+        benchbuild(argc > 2 ? stoul(argv[2]) : 10000000);
+        return 0;
+    }
+    if (argc > 1 && string(argv[1]) == "mapped") {
+        benchmapped(argc > 2 ? stoul(argv[2]) : 10000000);
+        return 0;
+    }
+    if (argc > 1 && string(argv[1]) == "churn") {
+        benchchurn();
+        return 0;
+    }
+    if (argc > 1 && string(argv[1]) == "concurrent") {
+        benchconcurrent();
+        return 0;
+    }
+    if (argc > 1 && string(argv[1]) == "hashes") {
+        benchdistributions();
+        return 0;
+    }
+    if (argc > 1 && string(argv[1]) == "growth") {
+        benchgrowth(argc > 2 ? stoul(argv[2]) : 4000000);
+        return 0;
+    }
+    if (argc > 1 && string(argv[1]) == "stats") {
+        demostats();
+        return 0;
+    }
+    if (argc > 1 && string(argv[1]) == "suite") {
+        suite(argc > 2 ? stoul(argv[2]) : 1000000);
+        return 0;
+    }
+
+    MyHashMap map;
+    
+    // Test cases
+    cout << "Testing HashMap implementation:" << endl;
+    
+    // Test put and get
+    map.put(1, 1);
+    map.put(2, 2);
+    cout << "get(1): " << map.get(1) << endl;  // Should return 1
+    cout << "get(2): " << map.get(2) << endl;  // Should return 2
+    cout << "get(3): " << map.get(3) << endl;  // Should return -1
+    
+    // Test update
+    map.put(2, 1);
+    cout << "get(2) after update: " << map.get(2) << endl;  // Should return 1
+    
+    // Test remove
+    map.remove(2);
+    cout << "get(2) after remove: " << map.get(2) << endl;  // Should return -1
+    
+    // Test edge cases
+    map.put(0, 0);
+    cout << "get(0): " << map.get(0) << endl;  // Should return 0
+    
+    map.put(1000000, 1000000);
+    cout << "get(1000000): " << map.get(1000000) << endl;  // Should return 1000000
+
+    // Test generic keys and values, found through a string_view
+    MyHashMap<string, vector<int>> lists;
+    lists.try_emplace("primes", vector<int>{2, 3, 5, 7});
+    const vector<int>* primes = lists.find(string_view("primes"));
+    cout << "find(primes) size: " << (primes ? (int)primes->size() : -1) << endl;  // Should return 4
+    cout << "find(squares): " << (lists.find("squares") ? "found" : "missing") << endl;  // Should be missing
     
     return 0;
 }
@@ -0,0 +1,287 @@
+// Frame output for headless and recorded runs. The renderer hands over each
+// frame as bottom-up RGBA (as glReadPixels returns it) and FrameWriter
+// flips, encodes and writes it on its own thread, so a slow disk or encoder
+// does not hold up the render loop.
+#pragma once
+
+#include <zlib.h>
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <deque>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+enum class FrameFormat {
+    raw,   // RGBA frames back to back, top row first
+    y4m,   // YUV4MPEG2 stream, 4:4:4 BT.601, readable by ffmpeg and most players
+    png    // one file per frame, output path a pattern such as frames/%05d.png
+};
+
+class FrameWriter {
+public:
+    // path "-" streams raw or y4m to stdout. With printHashes, a 64-bit
+    // FNV-1a hash of each frame's pixels is printed (to stderr if the frames
+    // are going to stdout), so two runs can be compared frame by frame
+    // without keeping the frames.
+    FrameWriter(FrameFormat fmt, const std::string& outputPath, int w, int h, int framesPerSecond, bool printHashes)
+        : format(fmt), path(outputPath), width(w), height(h), fps(framesPerSecond), hashes(printHashes), out(nullptr),
+          frameIndex(0), digits(0), done(false), failed(false) {}
+
+    ~FrameWriter() {
+        close();
+    }
+
+    // Splits a png output pattern around its frame number: exactly one %d
+    // or %0Nd field, %% for a literal percent sign, and nothing else after a
+    // %. False for any other pattern. The pattern is never handed to printf.
+    static bool splitPattern(const std::string& pattern, std::string& prefix, int& digits, std::string& suffix) {
+        bool found = false;
+        std::string* part = &prefix;
+        prefix.clear();
+        suffix.clear();
+        digits = 0;
+        for (size_t i = 0; i < pattern.size(); ++i) {
+            if (pattern[i] != '%') {
+                *part += pattern[i];
+                continue;
+            }
+            if (++i < pattern.size() && pattern[i] == '%') {
+                *part += '%';
+                continue;
+            }
+            if (found) {
+                return false;
+            }
+            // %0Nd, N from 1 to 9, or plain %d
+            if (i + 2 < pattern.size() && pattern[i] == '0' && pattern[i + 1] >= '1' && pattern[i + 1] <= '9') {
+                digits = pattern[i + 1] - '0';
+                i += 2;
+            }
+            if (i >= pattern.size() || pattern[i] != 'd') {
+                return false;
+            }
+            found = true;
+            part = &suffix;
+        }
+        return found;
+    }
+
+    // Opens the stream (or, for png, checks the pattern and nothing else
+    // until the first frame) and starts the writer thread
+    bool open() {
+        if (format == FrameFormat::png && !path.empty() && !splitPattern(path, prefix, digits, suffix)) {
+            std::cerr << "PNG output " << path << " needs one %d or %0Nd frame number" << std::endl;
+            return false;
+        }
+        if (!path.empty() && format != FrameFormat::png) {
+            out = path == "-" ? stdout : fopen(path.c_str(), "wb");
+            if (!out) {
+                std::cerr << "Failed to open " << path << " for writing" << std::endl;
+                return false;
+            }
+            if (format == FrameFormat::y4m) {
+                fprintf(out, "YUV4MPEG2 W%d H%d F%d:1 Ip A1:1 C444\n", width, height, fps);
+            }
+        }
+        worker = std::thread(&FrameWriter::loop, this);
+        return true;
+    }
+
+    // Writes out every queued frame and stops the writer thread
+    void close() {
+        if (!worker.joinable()) {
+            return;
+        }
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            done = true;
+        }
+        wake.notify_all();
+        worker.join();
+        if (out && out != stdout) {
+            fclose(out);
+        } else if (out) {
+            fflush(out);
+        }
+        out = nullptr;
+    }
+
+    // An empty width * height * 4 buffer to fill with the next frame,
+    // recycled from frames already written once there are some
+    std::vector<unsigned char> buffer() {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (spare.empty()) {
+            return std::vector<unsigned char>((size_t)width * height * 4);
+        }
+        std::vector<unsigned char> frame = std::move(spare.back());
+        spare.pop_back();
+        return frame;
+    }
+
+    // Queues a frame for writing. Blocks only while QUEUE_DEPTH frames are
+    // already waiting, which bounds memory if the writer falls behind.
+    void submit(std::vector<unsigned char> frame) {
+        std::unique_lock<std::mutex> lock(mutex);
+        room.wait(lock, [&] { return queue.size() < QUEUE_DEPTH; });
+        queue.push_back(std::move(frame));
+        wake.notify_one();
+    }
+
+    // False once any frame failed to write
+    bool ok() const {
+        return !failed;
+    }
+
+private:
+    static const size_t QUEUE_DEPTH = 4;
+
+    FrameFormat format;
+    std::string path;
+    int width, height, fps;
+    bool hashes;
+    FILE* out;
+    int frameIndex;
+    std::string prefix, suffix;   // png file name either side of the frame number
+    int digits;                   // zero-padded width of the frame number
+
+    std::thread worker;
+    std::mutex mutex;
+    std::condition_variable wake, room;
+    std::deque<std::vector<unsigned char>> queue;
+    std::vector<std::vector<unsigned char>> spare;
+    std::vector<unsigned char> rows, planes, compressed;
+    bool done;
+    std::atomic<bool> failed;
+
+    void loop() {
+        for (;;) {
+            std::vector<unsigned char> frame;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                wake.wait(lock, [&] { return done || !queue.empty(); });
+                if (queue.empty()) {
+                    return;
+                }
+                frame = std::move(queue.front());
+                queue.pop_front();
+            }
+            room.notify_one();
+
+            write(frame);
+
+            std::lock_guard<std::mutex> lock(mutex);
+            spare.push_back(std::move(frame));
+        }
+    }
+
+    void write(const std::vector<unsigned char>& frame) {
+        // Top row first, as every output format expects
+        size_t stride = (size_t)width * 4;
+        rows.resize(frame.size());
+        for (int y = 0; y < height; ++y) {
+            memcpy(&rows[y * stride], &frame[(height - 1 - y) * stride], stride);
+        }
+
+        if (hashes) {
+            uint64_t h = 14695981039346656037ull;
+            for (unsigned char b : rows) {
+                h = (h ^ b) * 1099511628211ull;
+            }
+            fprintf(out == stdout ? stderr : stdout, "frame %d %016llx\n", frameIndex, (unsigned long long)h);
+        }
+
+        bool written = true;
+        if (format == FrameFormat::raw && out) {
+            written = fwrite(rows.data(), 1, rows.size(), out) == rows.size();
+        } else if (format == FrameFormat::y4m && out) {
+            written = writeY4M();
+        } else if (format == FrameFormat::png && !path.empty()) {
+            written = writePNG();
+        }
+        if (!written && !failed) {
+            std::cerr << "Failed to write frame " << frameIndex << std::endl;
+            failed = true;
+        }
+        frameIndex++;
+    }
+
+    // Studio-range BT.601, full resolution chroma
+    bool writeY4M() {
+        size_t n = (size_t)width * height;
+        planes.resize(n * 3);
+        for (size_t i = 0; i < n; ++i) {
+            int r = rows[i * 4], g = rows[i * 4 + 1], b = rows[i * 4 + 2];
+            planes[i] = ((66 * r + 129 * g + 25 * b + 128) >> 8) + 16;
+            planes[n + i] = ((-38 * r - 74 * g + 112 * b + 128) >> 8) + 128;
+            planes[2 * n + i] = ((112 * r - 94 * g - 18 * b + 128) >> 8) + 128;
+        }
+        return fputs("FRAME\n", out) >= 0 && fwrite(planes.data(), 1, planes.size(), out) == planes.size();
+    }
+
+    // 8-bit RGB PNG: every row gets filter type 0, then the whole image is
+    // deflated at zlib's fastest level
+    bool writePNG() {
+        size_t rowBytes = (size_t)width * 3 + 1;
+        planes.resize(rowBytes * height);
+        for (int y = 0; y < height; ++y) {
+            unsigned char* dst = &planes[y * rowBytes];
+            const unsigned char* src = &rows[(size_t)y * width * 4];
+            *dst++ = 0;
+            for (int x = 0; x < width; ++x) {
+                *dst++ = src[x * 4];
+                *dst++ = src[x * 4 + 1];
+                *dst++ = src[x * 4 + 2];
+            }
+        }
+        uLongf size = compressBound(planes.size());
+        compressed.resize(size);
+        if (compress2(compressed.data(), &size, planes.data(), planes.size(), 1) != Z_OK) {
+            return false;
+        }
+
+        std::string number = std::to_string(frameIndex);
+        if ((int)number.size() < digits) {
+            number.insert(0, digits - number.size(), '0');
+        }
+        FILE* file = fopen((prefix + number + suffix).c_str(), "wb");
+        if (!file) {
+            return false;
+        }
+        unsigned char header[13];
+        putBE32(header, width);
+        putBE32(header + 4, height);
+        header[8] = 8;    // bit depth
+        header[9] = 2;    // truecolor
+        header[10] = header[11] = header[12] = 0;
+        static const unsigned char signature[8] = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n'};
+        bool written = fwrite(signature, 1, 8, file) == 8 && writeChunk(file, "IHDR", header, 13) &&
+                       writeChunk(file, "IDAT", compressed.data(), size) && writeChunk(file, "IEND", nullptr, 0);
+        return fclose(file) == 0 && written;
+    }
+
+    static void putBE32(unsigned char* p, uint32_t v) {
+        p[0] = v >> 24;
+        p[1] = v >> 16;
+        p[2] = v >> 8;
+        p[3] = v;
+    }
+
+    static bool writeChunk(FILE* file, const char* type, const unsigned char* data, size_t size) {
+        unsigned char word[4];
+        putBE32(word, size);
+        uLong crc = crc32(0, (const Bytef*)type, 4);
+        if (size > 0) {
+            crc = crc32(crc, data, size);
+        }
+        bool ok = fwrite(word, 1, 4, file) == 4 && fwrite(type, 1, 4, file) == 4 &&
+                  (size == 0 || fwrite(data, 1, size, file) == size);
+        putBE32(word, crc);
+        return ok && fwrite(word, 1, 4, file) == 4;
+    }
+};
@@ -1,40 +1,61 @@
 #include <GL/glew.h>
 #include <GLFW/glfw3.h>
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
 #include <glm/gtc/type_ptr.hpp>
 #include <iostream>
 #include <vector>
 #include <cmath>
+#include <cstddef>
+#include <cstdlib>
+#include <cstring>
+#include <random>
 #include <string>
+#include <chrono>
+#include "capture.h"
+#include "profiler.h"
+#include "simulation.h"
+
+// Shader sources. Every stage is compiled with frameBlockSource in front of
+// it, which supplies the version line and the per-frame uniform block.
+const char* frameBlockSource = R"(#version 330 core
+// Per-frame data shared by every shader, filled from FrameUniforms
+layout (std140) uniform Frame {
+    mat4 projection;
+    mat4 view;
+    vec4 lightPos;
+    vec4 viewPos;
+    float time;
+};
+)";
 
-// Shader sources
 const char* vertexShaderSource = R"(
-#version 330 core
 layout (location = 0) in vec3 aPos;
 layout (location = 1) in vec3 aNormal;
 
-uniform mat4 model;
-uniform mat4 view;
-uniform mat4 projection;
-uniform mat4 normalMatrix;
+// Per-instance attributes, one BodyInstance per body
+layout (location = 2) in mat4 aModel;
+layout (location = 6) in mat3 aNormalMatrix;
+layout (location = 9) in vec3 aColor;
 
 out vec3 FragPos;
 out vec3 Normal;
+out vec3 Color;
 
 void main() {
-    FragPos = vec3(model * vec4(aPos, 1.0));
-    Normal = mat3(normalMatrix) * aNormal;
+    FragPos = vec3(aModel * vec4(aPos, 1.0));
+    Normal = aNormalMatrix * aNormal;
+    Color = aColor;
     
     gl_Position = projection * view * vec4(FragPos, 1.0);
 }
 )";
 
 const char* sunFragmentShader = R"(
-#version 330 core
 out vec4 FragColor;
 
-uniform float time;
 in vec3 FragPos;
 in vec3 Normal;
 
@@ -52,29 +73,25 @@ void main() {
 )";
 
 const char* planetFragmentShader = R"(
-#version 330 core
 out vec4 FragColor;
 
-uniform vec3 planetColor;
-uniform vec3 lightPos;
-uniform vec3 viewPos;
-
 in vec3 FragPos;
 in vec3 Normal;
+in vec3 Color;
 
 void main() {
     vec3 norm = normalize(Normal);
-    vec3 lightDir = normalize(lightPos - FragPos);
+    vec3 lightDir = normalize(lightPos.xyz - FragPos);
     
     // Ambient lighting
-    vec3 ambient = 0.3 * planetColor;
+    vec3 ambient = 0.3 * Color;
     
     // Diffuse lighting
     float diff = max(dot(norm, lightDir), 0.0);
-    vec3 diffuse = diff * planetColor;
+    vec3 diffuse = diff * Color;
     
     // Simple specular highlight
-    vec3 viewDir = normalize(viewPos - FragPos);
+    vec3 viewDir = normalize(viewPos.xyz - FragPos);
     vec3 reflectDir = reflect(-lightDir, norm);
     float spec = pow(max(dot(viewDir, reflectDir), 0.0), 32);
     vec3 specular = vec3(0.3) * spec;
@@ -84,20 +101,38 @@ void main() {
 }
 )";
 
+// CPU side of the Frame uniform block. std140 puts each mat4 and vec4 on a
+// 16-byte boundary and rounds the block up to 16 bytes, so the vec3s are
+// stored as vec4s and the tail is padded.
+struct FrameUniforms {
+    glm::mat4 projection;
+    glm::mat4 view;
+    glm::vec4 lightPos;
+    glm::vec4 viewPos;
+    float time;
+    float pad[3];
+};
+static_assert(sizeof(FrameUniforms) == 176, "FrameUniforms must match the std140 Frame block");
+
+// Uniform buffer binding point the Frame block is attached to
+const unsigned int FRAME_BINDING = 0;
+
 class Shader {
 public:
     unsigned int ID;
     
     Shader(const char* vertexSource, const char* fragmentSource) {
         // Compile vertex shader
+        const char* vertexSources[] = {frameBlockSource, vertexSource};
         unsigned int vertex = glCreateShader(GL_VERTEX_SHADER);
-        glShaderSource(vertex, 1, &vertexSource, NULL);
+        glShaderSource(vertex, 2, vertexSources, NULL);
         glCompileShader(vertex);
         checkCompileErrors(vertex, "VERTEX");
         
         // Compile fragment shader
+        const char* fragmentSources[] = {frameBlockSource, fragmentSource};
         unsigned int fragment = glCreateShader(GL_FRAGMENT_SHADER);
-        glShaderSource(fragment, 1, &fragmentSource, NULL);
+        glShaderSource(fragment, 2, fragmentSources, NULL);
         glCompileShader(fragment);
         checkCompileErrors(fragment, "FRAGMENT");
         
@@ -110,24 +145,17 @@ public:
         
         glDeleteShader(vertex);
         glDeleteShader(fragment);
+        
+        unsigned int frameBlock = glGetUniformBlockIndex(ID, "Frame");
+        if (frameBlock != GL_INVALID_INDEX) {
+            glUniformBlockBinding(ID, frameBlock, FRAME_BINDING);
+        }
     }
     
     void use() {
         glUseProgram(ID);
     }
     
-    void setMat4(const std::string &name, const glm::mat4 &mat) {
-        glUniformMatrix4fv(glGetUniformLocation(ID, name.c_str()), 1, GL_FALSE, &mat[0][0]);
-    }
-    
-    void setVec3(const std::string &name, const glm::vec3 &value) {
-        glUniform3fv(glGetUniformLocation(ID, name.c_str()), 1, &value[0]);
-    }
-    
-    void setFloat(const std::string &name, float value) {
-        glUniform1f(glGetUniformLocation(ID, name.c_str()), value);
-    }
-
 private:
     void checkCompileErrors(unsigned int shader, std::string type) {
         int success;
@@ -148,6 +176,234 @@ private:
     }
 };
 
+// Per-instance data for one body, laid out as the vertex shader's instance
+// attributes expect
+struct BodyInstance {
+    glm::mat4 model;
+    glm::mat3 normalMatrix;
+    glm::vec3 color;
+};
+
+// Model and normal matrices for a sphere scaled by radius, spun by angle
+// about the Y axis and moved to position. Written out in closed form: for
+// T * R * S with uniform S, transpose(inverse(M)) is just R / radius, so no
+// per-body matrix inverse is needed.
+inline void writeInstance(BodyInstance& out, const glm::vec3& position, float angle, float radius,
+                          const glm::vec3& color) {
+    float c = cosf(angle);
+    float s = sinf(angle);
+    out.model[0] = glm::vec4(c * radius, 0.0f, -s * radius, 0.0f);
+    out.model[1] = glm::vec4(0.0f, radius, 0.0f, 0.0f);
+    out.model[2] = glm::vec4(s * radius, 0.0f, c * radius, 0.0f);
+    out.model[3] = glm::vec4(position, 1.0f);
+    
+    float inv = 1.0f / radius;
+    out.normalMatrix[0] = glm::vec3(c * inv, 0.0f, -s * inv);
+    out.normalMatrix[1] = glm::vec3(0.0f, inv, 0.0f);
+    out.normalMatrix[2] = glm::vec3(s * inv, 0.0f, c * inv);
+    out.color = color;
+}
+
+// Streams a fresh array of BodyInstance to the GPU every frame without
+// waiting for the GPU to finish reading the previous one.
+//
+// With GL_ARB_buffer_storage the buffer is mapped once, persistently, and
+// split into FRAMES regions used round robin; a fence after each frame's
+// draws tells us when its region may be overwritten, which is normally
+// already true by the time we come back to it. Without it, the buffer is
+// orphaned each frame (glBufferData with no data) so the driver hands back
+// fresh storage while the GPU keeps reading the old.
+class InstanceStream {
+public:
+    unsigned int buffer;
+    
+    InstanceStream()
+        : buffer(0), capacity(0), frame(0), mapped(nullptr), persistent(GLEW_ARB_buffer_storage), staged(false) {
+        for (int i = 0; i < FRAMES; ++i) {
+            fences[i] = 0;
+        }
+    }
+    
+    ~InstanceStream() {
+        destroy();
+    }
+    
+    // Room for count instances, to be filled before the draws that read them
+    BodyInstance* map(size_t count) {
+        if (count > capacity) {
+            create(count + count / 2);
+        }
+        if (!persistent) {
+            glBindBuffer(GL_ARRAY_BUFFER, buffer);
+            glBufferData(GL_ARRAY_BUFFER, capacity * sizeof(BodyInstance), NULL, GL_STREAM_DRAW);
+            BodyInstance* instances = (BodyInstance*)glMapBufferRange(
+                GL_ARRAY_BUFFER, 0, count * sizeof(BodyInstance), GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+            staged = instances == nullptr;
+            if (staged) {
+                // The map failed: fill a client-side copy for unmap to upload
+                staging.resize(count);
+                return staging.data();
+            }
+            return instances;
+        }
+        if (fences[frame]) {
+            glClientWaitSync(fences[frame], GL_SYNC_FLUSH_COMMANDS_BIT, ~0ull);
+            glDeleteSync(fences[frame]);
+            fences[frame] = 0;
+        }
+        return mapped + frame * capacity;
+    }
+    
+    // Byte offset of the instances written since map, for drawInstanced
+    size_t unmap() {
+        if (!persistent) {
+            glBindBuffer(GL_ARRAY_BUFFER, buffer);
+            if (staged) {
+                glBufferSubData(GL_ARRAY_BUFFER, 0, staging.size() * sizeof(BodyInstance), staging.data());
+            } else {
+                glUnmapBuffer(GL_ARRAY_BUFFER);
+            }
+            return 0;
+        }
+        return frame * capacity * sizeof(BodyInstance);
+    }
+    
+    // Call once the frame's draws are issued
+    void fence() {
+        if (persistent) {
+            fences[frame] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+            frame = (frame + 1) % FRAMES;
+        }
+    }
+
+private:
+    static const int FRAMES = 3;
+    
+    size_t capacity;   // instances per region
+    int frame;         // region written this frame
+    BodyInstance* mapped;
+    GLsync fences[FRAMES];
+    bool persistent;
+    bool staged;                          // this frame went to staging, not a mapping
+    std::vector<BodyInstance> staging;
+    
+    void create(size_t count) {
+        destroy();
+        capacity = count;
+        glGenBuffers(1, &buffer);
+        glBindBuffer(GL_ARRAY_BUFFER, buffer);
+        if (persistent) {
+            GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+            glBufferStorage(GL_ARRAY_BUFFER, FRAMES * capacity * sizeof(BodyInstance), NULL, flags);
+            mapped = (BodyInstance*)glMapBufferRange(GL_ARRAY_BUFFER, 0, FRAMES * capacity * sizeof(BodyInstance), flags);
+            if (!mapped) {
+                std::cerr << "Failed to map the instance buffer persistently, using orphaned uploads" << std::endl;
+                persistent = false;
+                create(count);
+            }
+        }
+    }
+    
+    void destroy() {
+        for (int i = 0; i < FRAMES; ++i) {
+            if (fences[i]) {
+                glClientWaitSync(fences[i], GL_SYNC_FLUSH_COMMANDS_BIT, ~0ull);
+                glDeleteSync(fences[i]);
+                fences[i] = 0;
+            }
+        }
+        if (buffer) {
+            if (mapped) {
+                glBindBuffer(GL_ARRAY_BUFFER, buffer);
+                glUnmapBuffer(GL_ARRAY_BUFFER);
+                mapped = nullptr;
+            }
+            glDeleteBuffers(1, &buffer);
+            buffer = 0;
+        }
+        frame = 0;
+    }
+};
+
+// Reads each rendered frame back through two pixel pack buffers used in
+// turn: glReadPixels into one returns at once, and the frame read into the
+// other on the previous call is mapped and handed to the writer, by which
+// time the GPU has long finished with it. Frames thus reach the writer one
+// frame late; finish collects the last one.
+class FrameReadback {
+public:
+    FrameReadback(int w, int h, FrameWriter* frameWriter) : width(w), height(h), writer(frameWriter), next(0) {
+        glGenBuffers(2, pbos);
+        for (int i = 0; i < 2; ++i) {
+            glBindBuffer(GL_PIXEL_PACK_BUFFER, pbos[i]);
+            glBufferData(GL_PIXEL_PACK_BUFFER, (size_t)width * height * 4, NULL, GL_STREAM_READ);
+            pending[i] = false;
+        }
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    }
+    
+    ~FrameReadback() {
+        glDeleteBuffers(2, pbos);
+    }
+    
+    // Call after rendering a frame, before swapping buffers
+    void capture() {
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, pbos[next]);
+        glReadPixels(0, 0, width, height, GL_RGBA, GL_UNSIGNED_BYTE, 0);
+        pending[next] = true;
+        next ^= 1;
+        collect(next);
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    }
+    
+    // Hands over the frame still in flight, if any
+    void finish() {
+        collect(next ^ 1);
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    }
+
+private:
+    int width, height;
+    FrameWriter* writer;
+    unsigned int pbos[2];
+    bool pending[2];
+    int next;   // buffer the next capture reads into
+    
+    void collect(int i) {
+        if (!pending[i]) {
+            return;
+        }
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, pbos[i]);
+        size_t size = (size_t)width * height * 4;
+        const void* pixels = glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, size, GL_MAP_READ_BIT);
+        if (pixels) {
+            std::vector<unsigned char> frame = writer->buffer();
+            memcpy(frame.data(), pixels, size);
+            writer->submit(std::move(frame));
+        }
+        glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+        pending[i] = false;
+    }
+};
+
+// Command-line settings for SolarSystem
+struct Options {
+    size_t extraBodies = 0;        // small bodies on random orbits, for scaling tests
+    bool headless = false;         // render offscreen through EGL, no window
+    int width = 1200, height = 800;
+    int frames = 0;                // stop after this many, 0 to run until closed
+    float fixedDt = 0.0f;          // seconds per frame, 0 to follow the clock
+    std::string output;            // where captured frames go, empty for nowhere
+    FrameFormat format = FrameFormat::raw;
+    bool hashes = false;           // print a hash of every frame
+    bool profile = false;          // print frame and zone times once a second
+    std::string tracePath;         // Chrome trace written here on exit, empty for none
+};
+
+// Bodies with a smaller radius are drawn with the low-poly sphere. The
+// asteroids (0.02-0.08) fall below it; the planets and moon do not.
+const float SMALL_RADIUS = 0.1f;
+
 class Sphere {
 public:
     unsigned int VAO, VBO, EBO;
@@ -159,9 +415,29 @@ public:
         setupMesh();
     }
     
-    void draw() {
+    // Draws count spheres in one call, instance attributes read from
+    // instanceBuffer starting at offset (an array of BodyInstance). The
+    // attributes are re-pointed on every call because the offset moves as the
+    // stream cycles through its buffer.
+    void drawInstanced(unsigned int instanceBuffer, size_t offset, int count) {
         glBindVertexArray(VAO);
-        glDrawElements(GL_TRIANGLES, indices.size(), GL_UNSIGNED_INT, 0);
+        glBindBuffer(GL_ARRAY_BUFFER, instanceBuffer);
+        
+        // mat4 model: locations 2-5, one column each
+        for (int i = 0; i < 4; ++i) {
+            glVertexAttribPointer(2 + i, 4, GL_FLOAT, GL_FALSE, sizeof(BodyInstance),
+                                  (void*)(offset + offsetof(BodyInstance, model) + i * sizeof(glm::vec4)));
+        }
+        // mat3 normalMatrix: locations 6-8
+        for (int i = 0; i < 3; ++i) {
+            glVertexAttribPointer(6 + i, 3, GL_FLOAT, GL_FALSE, sizeof(BodyInstance),
+                                  (void*)(offset + offsetof(BodyInstance, normalMatrix) + i * sizeof(glm::vec3)));
+        }
+        // vec3 color: location 9
+        glVertexAttribPointer(9, 3, GL_FLOAT, GL_FALSE, sizeof(BodyInstance),
+                              (void*)(offset + offsetof(BodyInstance, color)));
+        
+        glDrawElementsInstanced(GL_TRIANGLES, indices.size(), GL_UNSIGNED_INT, 0, count);
         glBindVertexArray(0);
     }
     
@@ -245,40 +521,38 @@ private:
         glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 6 * sizeof(float), (void*)(3 * sizeof(float)));
         glEnableVertexAttribArray(1);
         
-        glBindVertexArray(0);
-    }
-};
-
-struct CelestialBody {
-    glm::vec3 position;
-    glm::vec3 color;
-    float radius;
-    float orbitRadius;
-    float orbitSpeed;
-    float rotationSpeed;
-    float orbitAngle;
-    float rotationAngle;
-    
-    CelestialBody(glm::vec3 col, float r, float orbR, float orbSpd, float rotSpd) 
-        : color(col), radius(r), orbitRadius(orbR), orbitSpeed(orbSpd), 
-          rotationSpeed(rotSpd), orbitAngle(0), rotationAngle(0) {}
-    
-    void update(float deltaTime) {
-        orbitAngle += orbitSpeed * deltaTime;
-        rotationAngle += rotationSpeed * deltaTime;
+        // Instance attributes (model, normalMatrix, color) advance once per
+        // instance; drawInstanced points them at the instance buffer
+        for (int i = 2; i <= 9; ++i) {
+            glEnableVertexAttribArray(i);
+            glVertexAttribDivisor(i, 1);
+        }
         
-        position.x = orbitRadius * cos(orbitAngle);
-        position.z = orbitRadius * sin(orbitAngle);
-        position.y = 0.0f;
+        glBindVertexArray(0);
     }
 };
 
 class SolarSystem {
 private:
+    Options options;
     GLFWwindow* window;
+    
+    // Headless rendering: a surfaceless EGL context drawing into fbo
+    EGLDisplay eglDisplay;
+    EGLContext eglContext;
+    unsigned int fbo, colorBuffer, depthBuffer;
+    
+    // Frame capture, when options.output is set or hashes are wanted
+    FrameWriter* writer;
+    FrameReadback* readback;
+    
+    FrameProfiler* profiler;
     Shader* sunShader;
     Shader* planetShader;
     Sphere* sphere;
+    Sphere* smallSphere;    // low-poly mesh for bodies below SMALL_RADIUS
+    InstanceStream* instances;
+    unsigned int frameUBO;
     
     // Camera
     glm::vec3 cameraPos;
@@ -292,9 +566,8 @@ private:
     double lastX, lastY;
     bool mousePressed;
     
-    // Celestial bodies
-    std::vector<CelestialBody> planets;
-    CelestialBody* moon;
+    // Everything that orbits the sun
+    BodyStore bodies;
     
     // Time
     float currentTime;
@@ -302,7 +575,10 @@ private:
     float lastFrame;
 
 public:
-    SolarSystem() : firstMouse(true), mousePressed(false), cameraDistance(15.0f), 
+    SolarSystem(const Options& opts = Options()) : options(opts), window(nullptr), eglDisplay(EGL_NO_DISPLAY),
+                    eglContext(EGL_NO_CONTEXT), fbo(0), colorBuffer(0), depthBuffer(0), writer(nullptr),
+                    readback(nullptr), profiler(nullptr), sunShader(nullptr), planetShader(nullptr),
+                    sphere(nullptr), smallSphere(nullptr), instances(nullptr), frameUBO(0), firstMouse(true), mousePressed(false), cameraDistance(15.0f), 
                     cameraAngleX(0.0f), cameraAngleY(0.0f), currentTime(0.0f), 
                     deltaTime(0.0f), lastFrame(0.0f) {
         
@@ -311,14 +587,171 @@ public:
         cameraUp = glm::vec3(0.0f, 1.0f, 0.0f);
         
         // Initialize planets
-        planets.push_back(CelestialBody(glm::vec3(0.8f, 0.3f, 0.3f), 0.8f, 4.0f, 2.0f, 5.0f)); // Mars-like
-        planets.push_back(CelestialBody(glm::vec3(0.3f, 0.5f, 0.8f), 1.2f, 7.0f, 1.0f, 3.0f)); // Earth-like
+        bodies.add(glm::vec3(0.8f, 0.3f, 0.3f), 0.8f, 4.0f, 2.0f, 5.0f); // Mars-like
+        uint32_t earth = bodies.add(glm::vec3(0.3f, 0.5f, 0.8f), 1.2f, 7.0f, 1.0f, 3.0f); // Earth-like
         
         // Moon for the second planet (Earth-like)
-        moon = new CelestialBody(glm::vec3(0.7f, 0.7f, 0.7f), 0.3f, 2.0f, 8.0f, 10.0f);
+        bodies.add(glm::vec3(0.7f, 0.7f, 0.7f), 0.3f, 2.0f, 8.0f, 10.0f, earth);
+        
+        // Asteroid belt, seeded so every run sees the same bodies. It lies
+        // between the Earth-like planet's moon and the camera.
+        std::mt19937 rng(42);
+        std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+        for (size_t i = 0; i < options.extraBodies; ++i) {
+            float orbitRadius = 9.5f + 3.0f * unit(rng);
+            glm::vec3 color(0.4f + 0.3f * unit(rng), 0.4f + 0.2f * unit(rng), 0.35f + 0.2f * unit(rng));
+            float radius = 0.02f + 0.06f * unit(rng);
+            float rotationSpeed = 1.0f + 4.0f * unit(rng);
+            bodies.add(color, radius, orbitRadius, 20.0f / powf(orbitRadius, 1.5f), rotationSpeed, BodyStore::NONE,
+                       2.0f * M_PI * unit(rng));
+        }
     }
     
     bool initialize() {
+        if (options.headless ? !initializeHeadless() : !initializeWindow()) {
+            return false;
+        }
+        
+        glViewport(0, 0, options.width, options.height);
+        glEnable(GL_DEPTH_TEST);
+        glClearColor(0.0f, 0.0f, 0.1f, 1.0f);
+        
+        // Create shaders
+        sunShader = new Shader(vertexShaderSource, sunFragmentShader);
+        planetShader = new Shader(vertexShaderSource, planetFragmentShader);
+        
+        // Per-frame uniforms, shared by both shaders through FRAME_BINDING
+        glGenBuffers(1, &frameUBO);
+        glBindBuffer(GL_UNIFORM_BUFFER, frameUBO);
+        glBufferData(GL_UNIFORM_BUFFER, sizeof(FrameUniforms), NULL, GL_DYNAMIC_DRAW);
+        glBindBufferBase(GL_UNIFORM_BUFFER, FRAME_BINDING, frameUBO);
+        
+        // Create sphere meshes: full detail (1,224 triangles), and 36
+        // triangles for small bodies, which cover a few pixels at most
+        sphere = new Sphere();
+        smallSphere = new Sphere(1.0f, 6, 4);
+        instances = new InstanceStream();
+        profiler = new FrameProfiler(options.profile, options.tracePath);
+        
+        if (!options.output.empty() || options.hashes) {
+            int fps = options.fixedDt > 0.0f ? (int)lroundf(1.0f / options.fixedDt) : 60;
+            writer = new FrameWriter(options.format, options.output, options.width, options.height, fps,
+                                     options.hashes);
+            if (!writer->open()) {
+                return false;
+            }
+            readback = new FrameReadback(options.width, options.height, writer);
+        }
+        
+        return true;
+    }
+    
+    // Runs until the window is closed or options.frames have been drawn.
+    // With a fixed timestep frame n shows the system n * fixedDt seconds in,
+    // whatever the frame rate, so two runs (of the same build) render the
+    // same frames.
+    void run() {
+        auto start = std::chrono::steady_clock::now();
+        auto lastReport = start;
+        for (int frame = 0; options.frames == 0 || frame < options.frames; ++frame) {
+            if (!options.headless && glfwWindowShouldClose(window)) {
+                break;
+            }
+            
+            if (options.fixedDt > 0.0f) {
+                deltaTime = frame == 0 ? 0.0f : options.fixedDt;
+                currentTime = frame * options.fixedDt;
+            } else {
+                float currentFrame = options.headless
+                    ? std::chrono::duration<float>(std::chrono::steady_clock::now() - start).count()
+                    : glfwGetTime();
+                deltaTime = currentFrame - lastFrame;
+                lastFrame = currentFrame;
+                currentTime = currentFrame;
+            }
+            
+            profiler->beginFrame();
+            {
+                auto zone = profiler->cpu("processInput");
+                processInput();
+            }
+            {
+                auto zone = profiler->cpu("update");
+                update();
+            }
+            {
+                auto zone = profiler->cpu("render");
+                auto gpuZone = profiler->gpu("render");
+                render();
+            }
+            if (readback) {
+                auto zone = profiler->cpu("capture");
+                auto gpuZone = profiler->gpu("capture");
+                readback->capture();
+            }
+            
+            if (!options.headless) {
+                auto zone = profiler->cpu("swap");
+                glfwSwapBuffers(window);
+                glfwPollEvents();
+            }
+            
+            if (options.profile && std::chrono::steady_clock::now() - lastReport >= std::chrono::seconds(1)) {
+                profiler->summary(std::cerr);
+                lastReport = std::chrono::steady_clock::now();
+            }
+        }
+    }
+    
+    // False if any captured frame failed to write. Also releases whatever
+    // a failed initialize got as far as creating.
+    bool cleanup() {
+        bool ok = true;
+        if (profiler && profiler->active()) {
+            ok = profiler->finish();
+            profiler->report(std::cerr);
+        }
+        delete profiler;
+        if (readback) {
+            readback->finish();
+            delete readback;
+        }
+        if (writer) {
+            writer->close();
+            ok = writer->ok() && ok;
+            delete writer;
+        }
+        if (frameUBO) {
+            glDeleteBuffers(1, &frameUBO);
+        }
+        delete sunShader;
+        delete planetShader;
+        delete instances;
+        delete sphere;
+        delete smallSphere;
+        if (options.headless) {
+            if (fbo) {
+                glDeleteFramebuffers(1, &fbo);
+            }
+            if (colorBuffer) {
+                glDeleteRenderbuffers(1, &colorBuffer);
+                glDeleteRenderbuffers(1, &depthBuffer);
+            }
+            if (eglContext != EGL_NO_CONTEXT) {
+                eglMakeCurrent(eglDisplay, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+                eglDestroyContext(eglDisplay, eglContext);
+            }
+            if (eglDisplay != EGL_NO_DISPLAY) {
+                eglTerminate(eglDisplay);
+            }
+        } else {
+            glfwTerminate();
+        }
+        return ok;
+    }
+
+private:
+    bool initializeWindow() {
         if (!glfwInit()) {
             std::cerr << "Failed to initialize GLFW" << std::endl;
             return false;
@@ -328,7 +761,7 @@ public:
         glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
         glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
         
-        window = glfwCreateWindow(1200, 800, "Solar System OpenGL", NULL, NULL);
+        window = glfwCreateWindow(options.width, options.height, "Solar System OpenGL", NULL, NULL);
         if (!window) {
             std::cerr << "Failed to create GLFW window" << std::endl;
             glfwTerminate();
@@ -343,70 +776,83 @@ public:
         glfwSetMouseButtonCallback(window, mouseButtonCallback);
         glfwSetScrollCallback(window, scrollCallback);
         
+        glewExperimental = GL_TRUE;
         if (glewInit() != GLEW_OK) {
             std::cerr << "Failed to initialize GLEW" << std::endl;
             return false;
         }
         
-        glEnable(GL_DEPTH_TEST);
-        glClearColor(0.0f, 0.0f, 0.1f, 1.0f);
-        
-        // Create shaders
-        sunShader = new Shader(vertexShaderSource, sunFragmentShader);
-        planetShader = new Shader(vertexShaderSource, planetFragmentShader);
-        
-        // Create sphere mesh
-        sphere = new Sphere();
-        
+        // The framebuffer can be larger than the window on high-DPI screens
+        glfwGetFramebufferSize(window, &options.width, &options.height);
         return true;
     }
     
-    void run() {
-        while (!glfwWindowShouldClose(window)) {
-            float currentFrame = glfwGetTime();
-            deltaTime = currentFrame - lastFrame;
-            lastFrame = currentFrame;
-            currentTime = currentFrame;
-            
-            processInput();
-            update();
-            render();
-            
-            glfwSwapBuffers(window);
-            glfwPollEvents();
+    // A core 3.3 context with no surface at all, on Mesa's surfaceless
+    // platform where available (no X server or GPU needed; llvmpipe renders
+    // on the CPU) and the default display otherwise, drawing into an FBO
+    bool initializeHeadless() {
+        auto getPlatformDisplay = (PFNEGLGETPLATFORMDISPLAYEXTPROC)eglGetProcAddress("eglGetPlatformDisplayEXT");
+        if (getPlatformDisplay) {
+            eglDisplay = getPlatformDisplay(EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, NULL);
+        }
+        if (eglDisplay == EGL_NO_DISPLAY) {
+            eglDisplay = eglGetDisplay(EGL_DEFAULT_DISPLAY);
         }
+        if (eglDisplay == EGL_NO_DISPLAY || !eglInitialize(eglDisplay, NULL, NULL)) {
+            std::cerr << "Failed to initialize EGL" << std::endl;
+            return false;
+        }
+        
+        eglBindAPI(EGL_OPENGL_API);
+        const EGLint contextAttribs[] = {
+            EGL_CONTEXT_MAJOR_VERSION, 3,
+            EGL_CONTEXT_MINOR_VERSION, 3,
+            EGL_CONTEXT_OPENGL_PROFILE_MASK, EGL_CONTEXT_OPENGL_CORE_PROFILE_BIT,
+            EGL_NONE
+        };
+        eglContext = eglCreateContext(eglDisplay, EGL_NO_CONFIG_KHR, EGL_NO_CONTEXT, contextAttribs);
+        if (eglContext == EGL_NO_CONTEXT ||
+            !eglMakeCurrent(eglDisplay, EGL_NO_SURFACE, EGL_NO_SURFACE, eglContext)) {
+            std::cerr << "Failed to create a surfaceless EGL context (error 0x" << std::hex << eglGetError()
+                      << std::dec << ")" << std::endl;
+            return false;
+        }
+        
+        // glewInit would also look for a GLX display, which there is none of
+        glewExperimental = GL_TRUE;
+        if (glewContextInit() != GLEW_OK) {
+            std::cerr << "Failed to initialize GLEW" << std::endl;
+            return false;
+        }
+        
+        glGenRenderbuffers(1, &colorBuffer);
+        glBindRenderbuffer(GL_RENDERBUFFER, colorBuffer);
+        glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, options.width, options.height);
+        glGenRenderbuffers(1, &depthBuffer);
+        glBindRenderbuffer(GL_RENDERBUFFER, depthBuffer);
+        glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, options.width, options.height);
+        
+        glGenFramebuffers(1, &fbo);
+        glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+        glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, colorBuffer);
+        glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, depthBuffer);
+        if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+            std::cerr << "Offscreen framebuffer is incomplete" << std::endl;
+            return false;
+        }
+        return true;
     }
     
-    void cleanup() {
-        delete sunShader;
-        delete planetShader;
-        delete sphere;
-        delete moon;
-        glfwTerminate();
-    }
-
-private:
     void processInput() {
+        if (options.headless) {
+            return;
+        }
         if (glfwGetKey(window, GLFW_KEY_ESCAPE) == GLFW_PRESS)
             glfwSetWindowShouldClose(window, true);
     }
     
     void update() {
-        // Update planets
-        for (auto& planet : planets) {
-            planet.update(deltaTime);
-        }
-        
-        // Update moon to orbit around the second planet (Earth-like)
-        if (planets.size() > 1) {
-            moon->orbitAngle += moon->orbitSpeed * deltaTime;
-            moon->rotationAngle += moon->rotationSpeed * deltaTime;
-            
-            glm::vec3 planetPos = planets[1].position;
-            moon->position.x = planetPos.x + moon->orbitRadius * cos(moon->orbitAngle);
-            moon->position.z = planetPos.z + moon->orbitRadius * sin(moon->orbitAngle);
-            moon->position.y = planetPos.y;
-        }
+        bodies.update(deltaTime);
         
         // Update camera position based on angles
         updateCamera();
@@ -421,55 +867,46 @@ private:
     void render() {
         glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
         
-        // Set up matrices
-        glm::mat4 projection = glm::perspective(glm::radians(45.0f), 
-                                              (float)1200 / (float)800, 0.1f, 100.0f);
-        glm::mat4 view = glm::lookAt(cameraPos, cameraTarget, cameraUp);
+        // Set up matrices and the rest of the per-frame uniforms, uploaded
+        // once for both shaders
+        FrameUniforms frame;
+        frame.projection = glm::perspective(glm::radians(45.0f), 
+                                            (float)options.width / (float)options.height, 0.1f, 100.0f);
+        frame.view = glm::lookAt(cameraPos, cameraTarget, cameraUp);
+        frame.lightPos = glm::vec4(0.0f, 0.0f, 0.0f, 1.0f); // Sun position
+        frame.viewPos = glm::vec4(cameraPos, 1.0f);
+        frame.time = currentTime;
+        glBindBuffer(GL_UNIFORM_BUFFER, frameUBO);
+        glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(FrameUniforms), &frame);
+        
+        // Every body's instance data goes into one array: the sun first, then
+        // the bodies drawn with the full mesh from the front, and the small
+        // ones, drawn with the low-poly mesh, from the back
+        size_t count = bodies.size() + 1;
+        BodyInstance* out = instances->map(count);
+        writeInstance(out[0], glm::vec3(0.0f), 0.0f, 1.5f, glm::vec3(1.0f, 0.8f, 0.2f));
+        size_t large = 1, small = count;
+        for (size_t i = 0; i < bodies.size(); ++i) {
+            size_t slot = bodies.radius[i] < SMALL_RADIUS ? --small : large++;
+            writeInstance(out[slot], glm::vec3(bodies.x[i], 0.0f, bodies.z[i]), bodies.rotationAngle[i],
+                          bodies.radius[i], bodies.color[i]);
+        }
+        size_t offset = instances->unmap();
         
         // Render Sun
         sunShader->use();
-        sunShader->setMat4("projection", projection);
-        sunShader->setMat4("view", view);
-        sunShader->setFloat("time", currentTime);
-        
-        glm::mat4 sunModel = glm::mat4(1.0f);
-        sunModel = glm::scale(sunModel, glm::vec3(1.5f)); // Sun size
-        sunShader->setMat4("model", sunModel);
-        sunShader->setMat4("normalMatrix", glm::transpose(glm::inverse(sunModel)));
+        sphere->drawInstanced(instances->buffer, offset, 1);
         
-        sphere->draw();
-        
-        // Render Planets
+        // Render everything else in one call per mesh
         planetShader->use();
-        planetShader->setMat4("projection", projection);
-        planetShader->setMat4("view", view);
-        planetShader->setVec3("lightPos", glm::vec3(0.0f, 0.0f, 0.0f)); // Sun position
-        planetShader->setVec3("viewPos", cameraPos);
-        
-        for (const auto& planet : planets) {
-            glm::mat4 planetModel = glm::mat4(1.0f);
-            planetModel = glm::translate(planetModel, planet.position);
-            planetModel = glm::rotate(planetModel, planet.rotationAngle, glm::vec3(0.0f, 1.0f, 0.0f));
-            planetModel = glm::scale(planetModel, glm::vec3(planet.radius));
-            
-            planetShader->setMat4("model", planetModel);
-            planetShader->setMat4("normalMatrix", glm::transpose(glm::inverse(planetModel)));
-            planetShader->setVec3("planetColor", planet.color);
-            
-            sphere->draw();
+        if (large > 1) {
+            sphere->drawInstanced(instances->buffer, offset + sizeof(BodyInstance), large - 1);
+        }
+        if (small < count) {
+            smallSphere->drawInstanced(instances->buffer, offset + small * sizeof(BodyInstance), count - small);
         }
         
-        // Render Moon
-        glm::mat4 moonModel = glm::mat4(1.0f);
-        moonModel = glm::translate(moonModel, moon->position);
-        moonModel = glm::rotate(moonModel, moon->rotationAngle, glm::vec3(0.0f, 1.0f, 0.0f));
-        moonModel = glm::scale(moonModel, glm::vec3(moon->radius));
-        
-        planetShader->setMat4("model", moonModel);
-        planetShader->setMat4("normalMatrix", glm::transpose(glm::inverse(moonModel)));
-        planetShader->setVec3("planetColor", moon->color);
-        
-        sphere->draw();
+        instances->fence();
     }
     
     static void mouseCallback(GLFWwindow* window, double xpos, double ypos) {
@@ -526,15 +963,130 @@ private:
     }
 };
 
-int main() {
-    SolarSystem app;
+// Steps n bodies (1 in 16 a moon, 1 in 256 a moon of a moon) for a number
+// of frames with no window, scalar and vectorized, on one thread and on all
+// of them
+void benchUpdate(size_t n, int frames) {
+    BodyStore bodies;
+    std::mt19937 rng(7);
+    std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+    for (size_t i = 0; i < n; ++i) {
+        uint32_t parent = BodyStore::NONE;
+        if (i % 256 == 2) {
+            parent = i - 1;
+        } else if (i % 16 == 1) {
+            parent = i - 1;
+        }
+        bodies.add(glm::vec3(1.0f), 0.1f, 1.0f + 40.0f * unit(rng), 4.0f * unit(rng) - 2.0f, 5.0f * unit(rng), parent,
+                   2.0f * M_PI * unit(rng));
+    }
+    
+    std::vector<unsigned> threadCounts = {1};
+    if (std::thread::hardware_concurrency() > 1) {
+        threadCounts.push_back(std::thread::hardware_concurrency());
+    }
+    std::cout << n << " bodies, " << frames << " frames" << std::endl;
+    std::cout << "kernel\tthreads\tms/frame\tns/body" << std::endl;
+    for (unsigned threads : threadCounts) {
+        for (bool vectorized : {false, true}) {
+            bodies.vectorized = vectorized;
+            bodies.update(1.0f / 60.0f, threads);  // warm up
+            auto start = std::chrono::steady_clock::now();
+            for (int f = 0; f < frames; ++f) {
+                bodies.update(1.0f / 60.0f, threads);
+            }
+            double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+#ifndef __AVX2__
+            if (vectorized) {
+                std::cout << "(built without AVX2: the vector kernel falls back to scalar)" << std::endl;
+            }
+#endif
+            std::cout << (vectorized ? "avx2" : "scalar") << "\t" << threads << "\t" << ms / frames << "\t"
+                      << ms * 1e6 / frames / n << std::endl;
+        }
+    }
+}
+
+int main(int argc, char** argv) {
+    if (argc > 1 && strcmp(argv[1], "bench") == 0) {
+        benchUpdate(argc > 2 ? strtoul(argv[2], NULL, 10) : 1000000, argc > 3 ? atoi(argv[3]) : 100);
+        return 0;
+    }
+    
+    Options options;
+    bool formatGiven = false;
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        bool hasValue = i + 1 < argc;
+        if (arg == "--bodies" && hasValue) {
+            options.extraBodies = strtoul(argv[++i], NULL, 10);
+        } else if (arg == "--headless") {
+            options.headless = true;
+        } else if (arg == "--size" && hasValue && sscanf(argv[i + 1], "%dx%d", &options.width, &options.height) == 2) {
+            ++i;
+        } else if (arg == "--frames" && hasValue) {
+            options.frames = atoi(argv[++i]);
+        } else if (arg == "--fixed-dt" && hasValue) {
+            options.fixedDt = strtof(argv[++i], NULL);
+        } else if (arg == "--output" && hasValue) {
+            options.output = argv[++i];
+        } else if (arg == "--format" && hasValue) {
+            std::string format = argv[++i];
+            formatGiven = true;
+            if (format == "raw") {
+                options.format = FrameFormat::raw;
+            } else if (format == "y4m") {
+                options.format = FrameFormat::y4m;
+            } else if (format == "png") {
+                options.format = FrameFormat::png;
+            } else {
+                std::cerr << "Unknown format " << format << " (raw, y4m or png)" << std::endl;
+                return -1;
+            }
+        } else if (arg == "--hashes") {
+            options.hashes = true;
+        } else if (arg == "--profile") {
+            options.profile = true;
+        } else if (arg == "--trace" && hasValue) {
+            options.tracePath = argv[++i];
+        } else {
+            std::cerr << "Unknown option " << arg << std::endl;
+            return -1;
+        }
+    }
+    
+    // Without --format, go by the output's extension
+    const std::string& out = options.output;
+    if (!formatGiven && out.size() > 4) {
+        if (out.compare(out.size() - 4, 4, ".y4m") == 0) {
+            options.format = FrameFormat::y4m;
+        } else if (out.compare(out.size() - 4, 4, ".png") == 0) {
+            options.format = FrameFormat::png;
+        }
+    }
+    if (options.width <= 0 || options.height <= 0) {
+        std::cerr << "Bad --size, expected WIDTHxHEIGHT" << std::endl;
+        return -1;
+    }
+    std::string prefix, suffix;
+    int digits;
+    if (options.format == FrameFormat::png && !out.empty() && !FrameWriter::splitPattern(out, prefix, digits, suffix)) {
+        std::cerr << "Bad --output for png: needs exactly one %d or %0Nd frame number (and %% for a literal %), "
+                  << "such as frames/%05d.png" << std::endl;
+        return -1;
+    }
+    // A headless run has nobody to close its window
+    if (options.headless && options.frames == 0) {
+        options.frames = 300;
+    }
+    
+    SolarSystem app(options);
     
     if (!app.initialize()) {
+        app.cleanup();
         return -1;
     }
     
     app.run();
-    app.cleanup();
-    
-    return 0;
-}
\ No newline at end of file
+    return app.cleanup() ? 0 : -1;
+}
@@ -0,0 +1,322 @@
+// Frame-time profiler for the render loop. CPU zones are timed with
+// steady_clock, GPU zones with GL_TIME_ELAPSED queries, and each zone keeps
+// its last WINDOW samples so report() can give rolling p50/p99 figures. With
+// a trace path set, every zone instance is also kept and written out on exit
+// as Chrome trace JSON (chrome://tracing or ui.perfetto.dev).
+//
+// GPU results arrive a few frames late. Each GPU zone owns a ring of
+// QUERY_FRAMES query objects and a result is only read once
+// GL_QUERY_RESULT_AVAILABLE says so, so the profiler never waits on the GPU;
+// if a query is still busy when its slot comes round again, that frame's
+// sample for the zone is dropped. GPU zones skip the first frame, which
+// carries one-off driver work (and on llvmpipe the context's first timer
+// query reports a nonsense duration). Timer queries cannot nest, so GPU
+// zones must not overlap.
+#pragma once
+
+#include <GL/glew.h>
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <vector>
+
+class FrameProfiler {
+private:
+    using Clock = std::chrono::steady_clock;
+
+    static const size_t WINDOW = 1024;       // samples kept per zone for the percentiles
+    static const int QUERY_FRAMES = 4;       // timer queries in flight per GPU zone
+    static const size_t MAX_EVENTS = 1 << 22;
+
+    // Rolling window of durations in nanoseconds
+    struct Samples {
+        std::vector<uint64_t> ring;
+        size_t next = 0;
+
+        void add(uint64_t ns) {
+            if (ring.size() < WINDOW) {
+                ring.push_back(ns);
+            } else {
+                ring[next] = ns;
+                next = (next + 1) % WINDOW;
+            }
+        }
+
+        // q in [0, 1], in milliseconds
+        double percentile(double q) const {
+            if (ring.empty()) {
+                return 0.0;
+            }
+            std::vector<uint64_t> sorted = ring;
+            size_t k = std::min(sorted.size() - 1, (size_t)(q * sorted.size()));
+            std::nth_element(sorted.begin(), sorted.begin() + k, sorted.end());
+            return sorted[k] / 1e6;
+        }
+    };
+
+    struct Zone {
+        const char* name;
+        bool gpu;
+        Samples samples;
+        // GPU zones: the query ring, and for each slot whether a result is
+        // outstanding and when (CPU time, for the trace) it was issued
+        unsigned int queries[QUERY_FRAMES];
+        bool pending[QUERY_FRAMES];
+        uint64_t issued[QUERY_FRAMES];
+    };
+
+    struct Event {
+        int zone;       // -1 for the frame itself
+        uint64_t start, duration;   // ns since the profiler started
+    };
+
+    bool enabled;
+    std::string tracePath;
+    Clock::time_point origin;
+    Clock::time_point frameStart;
+    bool inFrame;
+    uint64_t frameIndex;
+    Samples frames;
+    std::vector<Zone> zones;
+    std::vector<Event> events;
+
+    uint64_t now() const {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - origin).count();
+    }
+
+    int zoneIndex(const char* name, bool gpu) {
+        for (size_t i = 0; i < zones.size(); ++i) {
+            if (zones[i].gpu == gpu && (zones[i].name == name || strcmp(zones[i].name, name) == 0)) {
+                return i;
+            }
+        }
+        Zone zone;
+        zone.name = name;
+        zone.gpu = gpu;
+        if (gpu) {
+            glGenQueries(QUERY_FRAMES, zone.queries);
+            std::fill(zone.pending, zone.pending + QUERY_FRAMES, false);
+        }
+        zones.push_back(zone);
+        return zones.size() - 1;
+    }
+
+    void record(int zone, uint64_t start, uint64_t duration) {
+        if (zone >= 0) {
+            zones[zone].samples.add(duration);
+        } else {
+            frames.add(duration);
+        }
+        if (!tracePath.empty() && events.size() < MAX_EVENTS) {
+            events.push_back({zone, start, duration});
+        }
+    }
+
+    // Collects every GPU result that is ready without waiting for the rest
+    void pollQueries() {
+        for (size_t z = 0; z < zones.size(); ++z) {
+            if (!zones[z].gpu) {
+                continue;
+            }
+            for (int slot = 0; slot < QUERY_FRAMES; ++slot) {
+                collect(z, slot);
+            }
+        }
+    }
+
+    // True if the slot is free (again)
+    bool collect(int z, int slot) {
+        Zone& zone = zones[z];
+        if (!zone.pending[slot]) {
+            return true;
+        }
+        int available = 0;
+        glGetQueryObjectiv(zone.queries[slot], GL_QUERY_RESULT_AVAILABLE, &available);
+        if (!available) {
+            return false;
+        }
+        GLuint64 ns = 0;
+        glGetQueryObjectui64v(zone.queries[slot], GL_QUERY_RESULT, &ns);
+        zone.pending[slot] = false;
+        record(z, zone.issued[slot], ns);
+        return true;
+    }
+
+public:
+    // Times a CPU zone for as long as it lives
+    class CpuScope {
+    public:
+        CpuScope(FrameProfiler* p, const char* name) : profiler(p), zone(-1), start(0) {
+            if (profiler) {
+                zone = profiler->zoneIndex(name, false);
+                start = profiler->now();
+            }
+        }
+
+        ~CpuScope() {
+            if (profiler) {
+                profiler->record(zone, start, profiler->now() - start);
+            }
+        }
+
+        CpuScope(const CpuScope&) = delete;
+        CpuScope& operator=(const CpuScope&) = delete;
+
+    private:
+        FrameProfiler* profiler;
+        int zone;
+        uint64_t start;
+    };
+
+    // Times the GL commands issued while it lives
+    class GpuScope {
+    public:
+        GpuScope(FrameProfiler* p, const char* name) : profiler(p), zone(-1), slot(0) {
+            if (!profiler || profiler->frameIndex == 0) {
+                profiler = nullptr;
+                return;
+            }
+            zone = profiler->zoneIndex(name, true);
+            slot = profiler->frameIndex % QUERY_FRAMES;
+            if (!profiler->collect(zone, slot)) {
+                profiler = nullptr;   // slot still busy: skip this sample
+                return;
+            }
+            Zone& z = profiler->zones[zone];
+            z.issued[slot] = profiler->now();
+            glBeginQuery(GL_TIME_ELAPSED, z.queries[slot]);
+        }
+
+        ~GpuScope() {
+            if (profiler) {
+                glEndQuery(GL_TIME_ELAPSED);
+                profiler->zones[zone].pending[slot] = true;
+            }
+        }
+
+        GpuScope(const GpuScope&) = delete;
+        GpuScope& operator=(const GpuScope&) = delete;
+
+    private:
+        FrameProfiler* profiler;
+        int zone;
+        int slot;
+    };
+
+    // Disabled, a profiler's scopes do nothing. tracePath, if not empty, is
+    // where finish writes the Chrome trace.
+    FrameProfiler(bool on = false, const std::string& trace = "")
+        : enabled(on || !trace.empty()), tracePath(trace), origin(Clock::now()), inFrame(false), frameIndex(0) {}
+
+    ~FrameProfiler() {
+        for (Zone& zone : zones) {
+            if (zone.gpu) {
+                glDeleteQueries(QUERY_FRAMES, zone.queries);
+            }
+        }
+    }
+
+    bool active() const {
+        return enabled;
+    }
+
+    CpuScope cpu(const char* name) {
+        return CpuScope(enabled ? this : nullptr, name);
+    }
+
+    GpuScope gpu(const char* name) {
+        return GpuScope(enabled ? this : nullptr, name);
+    }
+
+    // Marks the start of a frame; the frame time is the time between starts
+    void beginFrame() {
+        if (!enabled) {
+            return;
+        }
+        Clock::time_point t = Clock::now();
+        if (inFrame) {
+            uint64_t start = std::chrono::duration_cast<std::chrono::nanoseconds>(frameStart - origin).count();
+            record(-1, start, std::chrono::duration_cast<std::chrono::nanoseconds>(t - frameStart).count());
+            frameIndex++;
+        }
+        frameStart = t;
+        inFrame = true;
+        pollQueries();
+    }
+
+    // One line of p50/p99 pairs, in milliseconds, for a running display
+    void summary(std::ostream& out) const {
+        char line[64];
+        snprintf(line, sizeof(line), "frame %.2f/%.2f", frames.percentile(0.5), frames.percentile(0.99));
+        out << line;
+        for (const Zone& zone : zones) {
+            snprintf(line, sizeof(line), "  %s%s %.2f/%.2f", zone.gpu ? "gpu:" : "", zone.name,
+                     zone.samples.percentile(0.5), zone.samples.percentile(0.99));
+            out << line;
+        }
+        out << " ms (p50/p99)" << std::endl;
+    }
+
+    // p50 and p99 of the frame time and of every zone over the last WINDOW
+    // samples
+    void report(std::ostream& out) const {
+        char line[160];
+        snprintf(line, sizeof(line), "%-16s p50 %8.3f ms  p99 %8.3f ms  (%zu frames)", "frame",
+                 frames.percentile(0.5), frames.percentile(0.99), frames.ring.size());
+        out << line << std::endl;
+        for (const Zone& zone : zones) {
+            std::string name = std::string(zone.gpu ? "gpu " : "cpu ") + zone.name;
+            snprintf(line, sizeof(line), "%-16s p50 %8.3f ms  p99 %8.3f ms", name.c_str(),
+                     zone.samples.percentile(0.5), zone.samples.percentile(0.99));
+            out << line << std::endl;
+        }
+    }
+
+    // Waits for the GPU results still outstanding, which is fine once the
+    // loop is over, and writes the trace if one was asked for. CPU zones go
+    // on thread 1 and GPU zones on thread 2; GL_TIME_ELAPSED gives only a
+    // duration, so a GPU zone is drawn from the moment its commands were
+    // issued.
+    bool finish() {
+        if (!enabled) {
+            return true;
+        }
+        for (size_t z = 0; z < zones.size(); ++z) {
+            for (int slot = 0; zones[z].gpu && slot < QUERY_FRAMES; ++slot) {
+                if (zones[z].pending[slot]) {
+                    GLuint64 ns = 0;
+                    glGetQueryObjectui64v(zones[z].queries[slot], GL_QUERY_RESULT, &ns);
+                    zones[z].pending[slot] = false;
+                    record(z, zones[z].issued[slot], ns);
+                }
+            }
+        }
+        if (tracePath.empty()) {
+            return true;
+        }
+
+        FILE* file = fopen(tracePath.c_str(), "w");
+        if (!file) {
+            std::cerr << "Failed to open " << tracePath << " for writing" << std::endl;
+            return false;
+        }
+        fprintf(file, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+        fprintf(file, "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":1,\"args\":{\"name\":\"CPU\"}},\n");
+        fprintf(file, "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":2,\"args\":{\"name\":\"GPU\"}}");
+        for (const Event& e : events) {
+            const char* name = e.zone < 0 ? "frame" : zones[e.zone].name;
+            int tid = e.zone >= 0 && zones[e.zone].gpu ? 2 : 1;
+            fprintf(file, ",\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f}", name, tid,
+                    e.start / 1e3, e.duration / 1e3);
+        }
+        fprintf(file, "\n]}\n");
+        if (events.size() >= MAX_EVENTS) {
+            std::cerr << "Trace truncated at " << MAX_EVENTS << " events" << std::endl;
+        }
+        return fclose(file) == 0;
+    }
+};
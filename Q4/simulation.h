@@ -0,0 +1,213 @@
+// Simulation core for the solar system: every orbiting body lives in one
+// structure-of-arrays store, and a frame's orbit and rotation update is a
+// straight pass over those arrays, eight bodies at a time with AVX2 and
+// split across cores for large systems. No OpenGL here, so the update can be
+// benchmarked without a window (`./solar_system bench`).
+#pragma once
+
+#include <glm/glm.hpp>
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
+
+#ifdef __AVX2__
+// sin and cos of 8 angles in [0, 2pi) at once, good to about 1e-7: the
+// Cephes sinf/cosf reduction to an octant, then the same two minimax
+// polynomials, picked and signed per lane by the octant
+inline void sincos8(__m256 x, __m256& s, __m256& c) {
+    const __m256 fourOverPi = _mm256_set1_ps(1.27323954473516f);
+    __m256i j = _mm256_cvttps_epi32(_mm256_mul_ps(x, fourOverPi));
+    j = _mm256_and_si256(_mm256_add_epi32(j, _mm256_set1_epi32(1)), _mm256_set1_epi32(~1));
+    __m256 y = _mm256_cvtepi32_ps(j);
+
+    // x - y * pi/4, with pi/4 split in three so the product is exact
+    x = _mm256_sub_ps(x, _mm256_mul_ps(y, _mm256_set1_ps(0.78515625f)));
+    x = _mm256_sub_ps(x, _mm256_mul_ps(y, _mm256_set1_ps(2.4187564849853515625e-4f)));
+    x = _mm256_sub_ps(x, _mm256_mul_ps(y, _mm256_set1_ps(3.77489497744594108e-8f)));
+
+    __m256 z = _mm256_mul_ps(x, x);
+    __m256 cosPoly = _mm256_set1_ps(2.443315711809948e-5f);
+    cosPoly = _mm256_add_ps(_mm256_mul_ps(cosPoly, z), _mm256_set1_ps(-1.388731625493765e-3f));
+    cosPoly = _mm256_add_ps(_mm256_mul_ps(cosPoly, z), _mm256_set1_ps(4.166664568298827e-2f));
+    cosPoly = _mm256_mul_ps(_mm256_mul_ps(cosPoly, z), z);
+    cosPoly = _mm256_sub_ps(cosPoly, _mm256_mul_ps(z, _mm256_set1_ps(0.5f)));
+    cosPoly = _mm256_add_ps(cosPoly, _mm256_set1_ps(1.0f));
+
+    __m256 sinPoly = _mm256_set1_ps(-1.9515295891e-4f);
+    sinPoly = _mm256_add_ps(_mm256_mul_ps(sinPoly, z), _mm256_set1_ps(8.3321608736e-3f));
+    sinPoly = _mm256_add_ps(_mm256_mul_ps(sinPoly, z), _mm256_set1_ps(-1.6666654611e-1f));
+    sinPoly = _mm256_add_ps(_mm256_mul_ps(_mm256_mul_ps(sinPoly, z), x), x);
+
+    // Octants 2 and 6 (j & 2) swap the polynomials; sin is negated when
+    // j & 4, cos when (j - 2) & 4 is clear
+    __m256 swap = _mm256_castsi256_ps(_mm256_cmpeq_epi32(_mm256_and_si256(j, _mm256_set1_epi32(2)),
+                                                         _mm256_set1_epi32(2)));
+    __m256 sinSign = _mm256_castsi256_ps(_mm256_slli_epi32(_mm256_and_si256(j, _mm256_set1_epi32(4)), 29));
+    __m256 cosSign = _mm256_castsi256_ps(
+        _mm256_slli_epi32(_mm256_andnot_si256(_mm256_sub_epi32(j, _mm256_set1_epi32(2)), _mm256_set1_epi32(4)), 29));
+    s = _mm256_xor_ps(_mm256_blendv_ps(sinPoly, cosPoly, swap), sinSign);
+    c = _mm256_xor_ps(_mm256_blendv_ps(cosPoly, sinPoly, swap), cosSign);
+}
+#endif
+
+// Every body that orbits something: the sun's planets, their moons, moons of
+// those, and so on. Each attribute is its own array indexed by body id, so
+// the update streams through exactly the fields it uses.
+//
+// A body orbits its parent, or the origin (the sun) if it has none, in the
+// XZ plane. Parents must be added before their children; the update then
+// works level by level, computing every body's offset from its parent in
+// one parallel pass over all bodies and adding in the parent's position one
+// nesting depth at a time.
+class BodyStore {
+public:
+    static const uint32_t NONE = UINT32_MAX;
+
+    // Bodies per thread below which update stays on one thread
+    static const size_t PARALLEL_GRAIN = 1 << 15;
+
+    std::vector<float> x, z;               // world position
+    std::vector<float> orbitAngle, rotationAngle;
+    std::vector<float> orbitRadius, orbitSpeed, rotationSpeed;
+    std::vector<float> radius;
+    std::vector<glm::vec3> color;
+    std::vector<uint32_t> parent;
+
+    // Use the AVX2 kernel when built with it; false forces the scalar one
+    bool vectorized = true;
+
+    // Returns the new body's id
+    uint32_t add(glm::vec3 col, float r, float orbR, float orbSpd, float rotSpd, uint32_t par = NONE,
+                 float startAngle = 0.0f) {
+        if (par != NONE && par >= size()) {
+            throw std::out_of_range("BodyStore::add: parent must be added first");
+        }
+        uint32_t id = size();
+        x.push_back(0.0f);
+        z.push_back(0.0f);
+        orbitAngle.push_back(startAngle);
+        rotationAngle.push_back(0.0f);
+        orbitRadius.push_back(orbR);
+        orbitSpeed.push_back(orbSpd);
+        rotationSpeed.push_back(rotSpd);
+        radius.push_back(r);
+        color.push_back(col);
+        parent.push_back(par);
+
+        if (par != NONE) {
+            size_t depth = depthOf(par) + 1;
+            if (depth > levels.size()) {
+                levels.emplace_back();
+            }
+            levels[depth - 1].push_back(id);
+        }
+        return id;
+    }
+
+    size_t size() const {
+        return x.size();
+    }
+
+    // Advances every orbit and spin by deltaTime on up to nthreads threads
+    void update(float deltaTime, unsigned nthreads = std::thread::hardware_concurrency()) {
+        parallelFor(size(), nthreads, [&](size_t lo, size_t hi) {
+            step(lo, hi, deltaTime);
+        });
+        for (const std::vector<uint32_t>& level : levels) {
+            parallelFor(level.size(), nthreads, [&](size_t lo, size_t hi) {
+                for (size_t k = lo; k < hi; ++k) {
+                    uint32_t i = level[k];
+                    x[i] += x[parent[i]];
+                    z[i] += z[parent[i]];
+                }
+            });
+        }
+    }
+
+private:
+    // Ids of the bodies nested d + 1 deep at levels[d], each after its parent
+    std::vector<std::vector<uint32_t>> levels;
+
+    size_t depthOf(uint32_t id) const {
+        size_t depth = 0;
+        for (; parent[id] != NONE; id = parent[id]) {
+            ++depth;
+        }
+        return depth;
+    }
+
+    // Runs f over [0, n) in contiguous slices, one per thread, on at most
+    // nthreads threads and none beyond one per PARALLEL_GRAIN items. Slices
+    // start on multiples of 8, so step hands the same bodies to the AVX2
+    // loop and the same few to the scalar tail whatever the thread count,
+    // and positions come out bit for bit the same.
+    template <typename F>
+    static void parallelFor(size_t n, unsigned nthreads, F f) {
+        size_t slices = std::max<size_t>(1, std::min<size_t>(nthreads, n / PARALLEL_GRAIN));
+        if (slices == 1) {
+            f(0, n);
+            return;
+        }
+        auto boundary = [&](size_t t) {
+            return t == slices ? n : (n * t / slices) & ~size_t(7);
+        };
+        std::vector<std::thread> workers;
+        for (size_t t = 1; t < slices; ++t) {
+            workers.emplace_back(f, boundary(t), boundary(t + 1));
+        }
+        f(0, boundary(1));
+        for (std::thread& w : workers) {
+            w.join();
+        }
+    }
+
+    // Angles are kept in [0, 2pi) so that float precision does not drain
+    // away over a long run, and so that sincos8 sees the range it expects
+    static float wrap(float a) {
+        const float twoPi = 6.28318530717958648f;
+        return a - twoPi * floorf(a / twoPi);
+    }
+
+    // Advances bodies [lo, hi) and sets their position relative to their
+    // parent; update adds the parent's position afterwards
+    void step(size_t lo, size_t hi, float dt) {
+        size_t i = lo;
+#ifdef __AVX2__
+        if (vectorized) {
+            const __m256 vdt = _mm256_set1_ps(dt);
+            const __m256 twoPi = _mm256_set1_ps(6.28318530717958648f);
+            const __m256 invTwoPi = _mm256_set1_ps(0.159154943091895336f);
+            auto advance = [&](float* angle, const float* speed) {
+                __m256 a = _mm256_add_ps(_mm256_loadu_ps(angle), _mm256_mul_ps(_mm256_loadu_ps(speed), vdt));
+                a = _mm256_sub_ps(a, _mm256_mul_ps(twoPi, _mm256_floor_ps(_mm256_mul_ps(a, invTwoPi))));
+                // Rounding can leave a hair below 0 or land on 2pi itself
+                a = _mm256_max_ps(a, _mm256_setzero_ps());
+                a = _mm256_and_ps(a, _mm256_cmp_ps(a, twoPi, _CMP_LT_OQ));
+                _mm256_storeu_ps(angle, a);
+                return a;
+            };
+            for (; i + 8 <= hi; i += 8) {
+                __m256 a = advance(&orbitAngle[i], &orbitSpeed[i]);
+                advance(&rotationAngle[i], &rotationSpeed[i]);
+                __m256 s, c;
+                sincos8(a, s, c);
+                __m256 r = _mm256_loadu_ps(&orbitRadius[i]);
+                _mm256_storeu_ps(&x[i], _mm256_mul_ps(r, c));
+                _mm256_storeu_ps(&z[i], _mm256_mul_ps(r, s));
+            }
+        }
+#endif
+        for (; i < hi; ++i) {
+            orbitAngle[i] = wrap(orbitAngle[i] + orbitSpeed[i] * dt);
+            rotationAngle[i] = wrap(rotationAngle[i] + rotationSpeed[i] * dt);
+            x[i] = orbitRadius[i] * cosf(orbitAngle[i]);
+            z[i] = orbitRadius[i] * sinf(orbitAngle[i]);
+        }
+    }
+};
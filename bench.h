@@ -0,0 +1,185 @@
+// Workload-driven benchmark harness shared by Q1.cpp (LRUCache) and Q2.cpp
+// (MyHashMap): `./lru_cache suite` and `./hashmap suite` run the same key
+// distributions over several key-space sizes and thread counts and print one
+// JSON document, so two builds can be compared with a plain diff or a script.
+//
+// Key streams are generated before the clock starts. Latency is sampled with
+// SampledTimer (one operation in 16), so the percentiles include the cost of
+// one steady_clock read, about 20 ns; compare them between builds rather than
+// reading them as absolute costs.
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <ostream>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+#include "metrics.h"
+
+enum class Workload
+{
+    uniform,   // every key equally likely
+    zipf,      // Zipf(0.99) by key rank: key 0 is the hottest
+    scan       // zipf, with every 10th block of 1000 keys replaced by a sequential sweep
+};
+
+inline const char *workloadname(Workload w)
+{
+    switch (w)
+    {
+    case Workload::uniform:
+        return "uniform";
+    case Workload::zipf:
+        return "zipf";
+    default:
+        return "scan";
+    }
+}
+
+// One key stream per thread, each opsperthread long, over [0, keyspace).
+// Threads get independent seeds; scan sweeps start at a different offset in
+// every thread so they do not move through the key space in lockstep.
+inline std::vector<std::vector<uint32_t>> makekeys(Workload w, uint32_t keyspace, int nthreads, size_t opsperthread)
+{
+    std::vector<double> cdf;
+    if (w != Workload::uniform)
+    {
+        cdf.resize(keyspace);
+        double sum = 0;
+        for (uint32_t i = 0; i < keyspace; i++)
+            cdf[i] = sum += 1.0 / std::pow(i + 1, 0.99);
+    }
+
+    std::vector<std::vector<uint32_t>> streams(nthreads);
+    for (int t = 0; t < nthreads; t++)
+    {
+        std::mt19937_64 rng(t * 7919 + keyspace + (int)w);
+        std::uniform_int_distribution<uint32_t> uniform(0, keyspace - 1);
+        std::uniform_real_distribution<double> u(0, cdf.empty() ? 1 : cdf.back());
+        uint32_t sweep = (uint32_t)((uint64_t)keyspace * t / nthreads);
+        auto &keys = streams[t];
+        keys.resize(opsperthread);
+        for (size_t i = 0; i < opsperthread; i++)
+        {
+            if (w == Workload::uniform)
+                keys[i] = uniform(rng);
+            else if (w == Workload::scan && i / 1000 % 10 == 9)
+                keys[i] = sweep++ % keyspace;
+            else
+                keys[i] = std::lower_bound(cdf.begin(), cdf.end(), u(rng)) - cdf.begin();
+        }
+    }
+    return streams;
+}
+
+class BenchResult
+{
+public:
+    std::string structure;
+    Workload workload = Workload::uniform;
+    uint32_t keyspace = 0;
+    int threads = 0;
+    uint64_t ops = 0;
+    uint64_t hits = 0;
+    double seconds = 0;
+    LatencyHistogram latency;
+
+    double opspersec() const
+    {
+        return seconds > 0 ? ops / seconds : 0;
+    }
+};
+
+// Runs op(thread, i, key) over each thread's key stream, all threads released
+// together, and returns the aggregate throughput and the merged latency
+// histogram. op returns true for a hit, which fills hit_ratio in the output.
+template <typename Op>
+BenchResult runworkload(const std::string &structure, Workload w, uint32_t keyspace,
+                        const std::vector<std::vector<uint32_t>> &streams, Op op)
+{
+    BenchResult r;
+    r.structure = structure;
+    r.workload = w;
+    r.keyspace = keyspace;
+    r.threads = (int)streams.size();
+
+    std::vector<LatencyHistogram> hists(streams.size());
+    std::vector<uint64_t> hits(streams.size());
+    std::vector<std::thread> workers;
+    std::atomic<int> ready{0};
+    std::atomic<bool> go{false};
+    for (int t = 0; t < r.threads; t++)
+    {
+        workers.emplace_back([&, t]()
+        {
+            const auto &keys = streams[t];
+            uint64_t h = 0;
+            ready++;
+            while (!go.load(std::memory_order_acquire))
+                std::this_thread::yield();
+            for (size_t i = 0; i < keys.size(); i++)
+            {
+                SampledTimer timer(hists[t]);
+                h += op(t, i, keys[i]);
+            }
+            hits[t] = h;
+        });
+    }
+    while (ready.load() < r.threads)
+        std::this_thread::yield();
+    auto start = std::chrono::steady_clock::now();
+    go.store(true, std::memory_order_release);
+    for (auto &w : workers)
+        w.join();
+    r.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    for (int t = 0; t < r.threads; t++)
+    {
+        r.latency.merge(hists[t]);
+        r.ops += streams[t].size();
+        r.hits += hits[t];
+    }
+    return r;
+}
+
+// 1, 2, 4, ... up to the hardware thread count, and at least up to 4 so the
+// contended paths are exercised on small machines too.
+inline std::vector<int> benchthreads()
+{
+    std::vector<int> counts;
+    int most = std::max(4, (int)std::thread::hardware_concurrency());
+    for (int n = 1; n <= most; n *= 2)
+        counts.push_back(n);
+    return counts;
+}
+
+inline void printjson(std::ostream &out, const char *suite, const std::vector<BenchResult> &results)
+{
+    out << "{\n  \"suite\": \"" << suite << "\",\n";
+#ifdef __VERSION__
+    out << "  \"compiler\": \"" << __VERSION__ << "\",\n";
+#endif
+    out << "  \"metrics\": " << (metricsenabled ? "true" : "false") << ",\n";
+    out << "  \"results\": [";
+    char line[512];
+    for (size_t i = 0; i < results.size(); i++)
+    {
+        const BenchResult &r = results[i];
+        snprintf(line, sizeof(line),
+                 "%s\n    {\"structure\": \"%s\", \"workload\": \"%s\", \"keys\": %u, \"threads\": %d, "
+                 "\"ops\": %llu, \"seconds\": %.4f, \"ops_per_sec\": %.0f, \"hit_ratio\": %.4f, "
+                 "\"p50_ns\": %llu, \"p99_ns\": %llu, \"p999_ns\": %llu, \"max_ns\": %llu}",
+                 i ? "," : "", r.structure.c_str(), workloadname(r.workload), r.keyspace, r.threads,
+                 (unsigned long long)r.ops, r.seconds, r.opspersec(), r.ops ? (double)r.hits / r.ops : 0.0,
+                 (unsigned long long)r.latency.percentile(50), (unsigned long long)r.latency.percentile(99),
+                 (unsigned long long)r.latency.percentile(99.9), (unsigned long long)r.latency.maxvalue);
+        out << line;
+    }
+    out << "\n  ]\n}" << std::endl;
+}
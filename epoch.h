@@ -0,0 +1,154 @@
+// Epoch-based reclamation shared by Q1.cpp (ClockCache) and Q2.cpp
+// (ConcurrentHashMap).
+//
+// A thread pins the current global epoch while it holds pointers into a
+// lock-free structure. A writer that unlinks a node retires it instead of
+// deleting it, and the node is freed only once the global epoch has moved two
+// steps past its retirement. The epoch only advances when every pinned thread
+// has caught up with it, so by then no reader that could have seen the node is
+// still running. Each thread keeps a record with its pinned epoch and its own
+// list of retired pointers; records of exited threads are reused by new ones,
+// retired pointers included.
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <deque>
+
+class EpochDomain
+{
+public:
+    static EpochDomain &global()
+    {
+        static EpochDomain domain;
+        return domain;
+    }
+
+    void pin()
+    {
+        record *r = local();
+        if (r->depth++ == 0)
+        {
+            r->state.store(epoch.load() << 1 | 1, std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+        }
+    }
+
+    void unpin()
+    {
+        record *r = local();
+        if (--r->depth == 0)
+            r->state.store(0, std::memory_order_release);
+    }
+
+    // Calls del(p, arg) once no pinned thread can still be reading p
+    void retire(void *p, void (*del)(void *, void *), void *arg = nullptr)
+    {
+        record *r = local();
+        r->limbo.push_back({epoch.load(), p, del, arg});
+        if (r->limbo.size() % 64 == 0)
+            collect(r);
+    }
+
+    ~EpochDomain()
+    {
+        for (record *r = records.load(); r != nullptr;)
+        {
+            for (auto &item : r->limbo)
+                item.del(item.p, item.arg);
+            record *next = r->next;
+            delete r;
+            r = next;
+        }
+    }
+
+private:
+    struct retired
+    {
+        uint64_t epoch;
+        void *p;
+        void (*del)(void *, void *);
+        void *arg;
+    };
+
+    struct alignas(64) record
+    {
+        std::atomic<uint64_t> state{0}; // 0 when unpinned, else epoch << 1 | 1
+        std::atomic<bool> inuse{true};
+        record *next = nullptr;
+        int depth = 0;              // nested pins; the owning thread only
+        std::deque<retired> limbo;  // oldest first; the owning thread only
+    };
+
+    // Hands the calling thread's record back for reuse when the thread exits
+    struct owner
+    {
+        record *rec = nullptr;
+        ~owner()
+        {
+            if (rec != nullptr)
+                rec->inuse.store(false, std::memory_order_release);
+        }
+    };
+
+    std::atomic<uint64_t> epoch{1};
+    std::atomic<record *> records{nullptr};
+
+    record *local()
+    {
+        thread_local owner own;
+        if (own.rec == nullptr)
+        {
+            for (record *r = records.load(); r != nullptr && own.rec == nullptr; r = r->next)
+            {
+                bool free = false;
+                if (r->inuse.compare_exchange_strong(free, true))
+                    own.rec = r;
+            }
+            if (own.rec == nullptr)
+            {
+                record *r = new record;
+                r->next = records.load();
+                while (!records.compare_exchange_weak(r->next, r))
+                    ;
+                own.rec = r;
+            }
+        }
+        return own.rec;
+    }
+
+    // Advances the epoch if every pinned thread is in it, then frees what
+    // this thread retired at least two epochs ago
+    void collect(record *mine)
+    {
+        uint64_t e = epoch.load();
+        bool caughtup = true;
+        for (record *r = records.load(); r != nullptr && caughtup; r = r->next)
+        {
+            uint64_t st = r->state.load();
+            caughtup = (st & 1) == 0 || (st >> 1) == e;
+        }
+        if (caughtup)
+            epoch.compare_exchange_strong(e, e + 1);
+        e = epoch.load();
+        while (!mine->limbo.empty() && mine->limbo.front().epoch + 2 <= e)
+        {
+            retired &item = mine->limbo.front();
+            item.del(item.p, item.arg);
+            mine->limbo.pop_front();
+        }
+    }
+};
+
+// Pins the calling thread for as long as it lives
+struct EpochGuard
+{
+    EpochGuard()
+    {
+        EpochDomain::global().pin();
+    }
+    ~EpochGuard()
+    {
+        EpochDomain::global().unpin();
+    }
+};
@@ -0,0 +1,120 @@
+// Optional instrumentation shared by Q1.cpp (LRUCache) and Q2.cpp (MyHashMap).
+//
+// Build with -DENABLE_METRICS to turn it on. Without it every METRICS(...)
+// statement expands to nothing, so the counters, timers and histogram updates
+// are compiled out entirely and the stats() snapshots report enabled == false.
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+
+#ifdef ENABLE_METRICS
+#define METRICS(...) __VA_ARGS__
+static constexpr bool metricsenabled = true;
+#else
+#define METRICS(...)
+static constexpr bool metricsenabled = false;
+#endif
+
+// HDR-style latency histogram: values (in ns) are bucketed by power of two and
+// then linearly into 16 sub-buckets, so every value keeps ~6% relative
+// precision across the whole 64-bit range in a fixed array of counters.
+class LatencyHistogram
+{
+public:
+    static constexpr int subbits = 4;
+    static constexpr int nbuckets = (64 - subbits + 1) << subbits;
+
+    uint64_t counts[nbuckets];
+    uint64_t total = 0;
+    uint64_t maxvalue = 0;
+    uint32_t sampletick = 0;   // drives SampledTimer
+
+    LatencyHistogram()
+    {
+        memset(counts, 0, sizeof(counts));
+    }
+
+    static int indexof(uint64_t v)
+    {
+        if (v < (1u << subbits))
+            return (int)v;
+        int shift = 63 - __builtin_clzll(v) - subbits;
+        return ((shift + 1) << subbits) + (int)((v >> shift) & ((1u << subbits) - 1));
+    }
+
+    // Smallest value that lands in bucket idx.
+    static uint64_t lowerbound(int idx)
+    {
+        if (idx < (1 << subbits))
+            return idx;
+        int shift = (idx >> subbits) - 1;
+        return (uint64_t)((1 << subbits) + (idx & ((1 << subbits) - 1))) << shift;
+    }
+
+    void record(uint64_t ns)
+    {
+        counts[indexof(ns)]++;
+        total++;
+        if (ns > maxvalue)
+            maxvalue = ns;
+    }
+
+    void merge(const LatencyHistogram &other)
+    {
+        for (int i = 0; i < nbuckets; i++)
+            counts[i] += other.counts[i];
+        total += other.total;
+        if (other.maxvalue > maxvalue)
+            maxvalue = other.maxvalue;
+    }
+
+    // Upper edge of the bucket holding the p-th percentile (0 < p <= 100),
+    // capped at the largest value recorded.
+    uint64_t percentile(double p) const
+    {
+        if (total == 0)
+            return 0;
+        uint64_t rank = (uint64_t)(p / 100.0 * total + 0.5);
+        if (rank == 0)
+            rank = 1;
+        uint64_t seen = 0;
+        for (int i = 0; i < nbuckets; i++)
+        {
+            seen += counts[i];
+            if (seen >= rank)
+            {
+                uint64_t upper = i + 1 < nbuckets ? lowerbound(i + 1) - 1 : UINT64_MAX;
+                return upper < maxvalue ? upper : maxvalue;
+            }
+        }
+        return maxvalue;
+    }
+};
+
+// Times one call in every 16 on the steady clock and records it into the
+// histogram, which keeps its own sampling counter. Reading the clock costs
+// about as much as a cache hit, so sampling keeps the overhead to a counter
+// increment on most operations while still filling the tail percentiles
+// within a few thousand calls.
+class SampledTimer
+{
+public:
+    static constexpr uint32_t every = 16;
+
+    LatencyHistogram *hist;
+    std::chrono::steady_clock::time_point start;
+
+    explicit SampledTimer(LatencyHistogram &h) : hist(h.sampletick++ % every == 0 ? &h : nullptr)
+    {
+        if (hist)
+            start = std::chrono::steady_clock::now();
+    }
+
+    ~SampledTimer()
+    {
+        if (hist)
+            hist->record(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count());
+    }
+};